@@ -5,8 +5,22 @@
 #include <sstream>
 #include <memory>
 #include <windows.h>
+#include <conio.h>
 #include <vector>
 #include <algorithm>
+#include <functional>
+#include <cstdio>
+#include <unordered_map>
+#include <unordered_set>
+#include <queue>
+#include <cstring>
+#include <climits>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
 
 using namespace std;
 
@@ -14,42 +28,706 @@ void setConsoleColor(WORD color) {
     SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), color);
 }
 
-void showMenu() {
-    cout << "+----------------------------------+" << endl;
-    cout << "|               МЕНЮ               |" << endl;
-    cout << "+----------------------------------+" << endl;
-    cout << "|  1  | Додати повідомлення        |" << endl;
-    cout << "|  2  | Показати всі повідомлення  |" << endl;
-    cout << "|  3  | Зберегти переписку         |" << endl;
-    cout << "|  4  | Завантажити переписку      |" << endl;
-    cout << "|  5  | Редагувати повідомлення    |" << endl;
-    cout << "|  6  | Очистити переписку         |" << endl;
-    cout << "|  7  | Пошук повідомлення         |" << endl;
-    cout << "|  8  | Видалити повідомлення      |" << endl;
-    cout << "|  9  | Статистика чату            |" << endl;
-    cout << "|  0  | Вихід                      |" << endl;
-    cout << "+----------------------------------+" << endl;
+// ESC-послідовність, що вмикає той самий колір, що й атрибут консолі.
+// Дозволяє зібрати кольоровий вивід у звичайний рядок байтів.
+string colorSequence(WORD color) {
+    static const int ansi[8] = { 0, 4, 2, 6, 1, 5, 3, 7 }; // біти RGB консолі -> колір ANSI
+    int foreground = ansi[color & 7] + ((color & FOREGROUND_INTENSITY) ? 90 : 30);
+    int background = ansi[(color >> 4) & 7] + ((color & BACKGROUND_INTENSITY) ? 100 : 40);
+    return "\033[" + to_string(foreground) + ";" + to_string(background) + "m";
+}
+
+// Рядок кадру, зібраний з форматованих частин:
+// screen.line(Row() << "| Всього " << setw(4) << n << " |");
+class Row {
+private:
+    ostringstream stream;
+
+public:
+    template <typename T>
+    Row& operator<<(const T& value) {
+        stream << value;
+        return *this;
+    }
+
+    operator string() const {
+        return stream.str();
+    }
+};
+
+// Модель екрана з подвійною буферизацією. Кадр — меню та рамки з
+// повідомленнями — будується в пам'яті, а present() порівнює його з
+// попереднім і виводить лише змінені рядки через ESC-послідовності
+// позиціювання курсора, без запуску "cls" в окремому процесі.
+// Вільний вивід після кадру (історія чату, результати пошуку, введення)
+// стирається наступним present(); якщо такий вивід міг прокрутити екран,
+// виклик invalidate() змушує наступний кадр перемалюватися повністю.
+class Screen {
+private:
+    vector<string> shown;  // кадр, який зараз на екрані
+    vector<string> frame;  // кадр, що будується
+    bool valid = false;
+
+    static const vector<string>& menuTemplate() {
+        static const vector<string> lines = {
+            "+----------------------------------+",
+            "|               МЕНЮ               |",
+            "+----------------------------------+",
+            "|  1  | Додати повідомлення        |",
+            "|  2  | Показати всі повідомлення  |",
+            "|  3  | Зберегти переписку         |",
+            "|  4  | Завантажити переписку      |",
+            "|  5  | Редагувати повідомлення    |",
+            "|  6  | Очистити переписку         |",
+            "|  7  | Пошук повідомлення         |",
+            "|  8  | Видалити повідомлення      |",
+            "|  9  | Статистика чату            |",
+            "| 10  | Відкрити архів (читання)   |",
+            "| 11  | Експортувати переписку     |",
+            "| 12  | Змінити чат                |",
+            "| 13  | Об'єднати історії          |",
+            "|  0  | Вихід                      |",
+            "+----------------------------------+"
+        };
+        return lines;
+    }
+
+    static int windowHeight() {
+        CONSOLE_SCREEN_BUFFER_INFO csbi;
+        if (!GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi)) return 0;
+        return csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
+    }
+
+    static void moveTo(string& out, size_t row) {
+        out += "\033[";
+        out += to_string(row + 1);
+        out += ";1H";
+    }
+
+public:
+    // Починає новий кадр з меню
+    void begin() {
+        frame = menuTemplate();
+    }
+
+    void line(const string& text) {
+        frame.push_back(text);
+    }
+
+    void present() {
+        string out;
+
+        // Під кадром ще рядок запрошення і рядок, на який переходить курсор
+        // після Enter. Якщо вони не вміщаються, екран прокрутиться й
+        // адресація рядків зіб'ється
+        bool fits = static_cast<int>(frame.size()) + 2 <= windowHeight();
+        if (!valid || !fits) {
+            out += "\033[2J";
+            shown.clear();
+        }
+
+        for (size_t row = 0; row < frame.size(); row++) {
+            if (row < shown.size() && shown[row] == frame[row]) continue;
+            moveTo(out, row);
+            out += frame[row];
+            out += "\033[K";
+        }
+
+        // Курсор — під кадром; решту попереднього виводу стираємо
+        moveTo(out, frame.size());
+        out += "\033[J";
+
+        cout.write(out.data(), out.size());
+        cout.flush();
+
+        shown.swap(frame);
+        frame.clear();
+        valid = fits;
+    }
+
+    void invalidate() {
+        valid = false;
+    }
+};
+
+Screen screen;
+
+// Текст повідомлення у вигляді rope — послідовності незмінних фрагментів
+// до CHUNK_SIZE байтів. Дописування заповнює лише останній фрагмент, тож
+// вставлені логи й документи на кілька мегабайтів не потребують суцільного
+// буфера та перевиділень. Алгоритми (виведення, пошук, запис у файл)
+// проходять текст по фрагментах через forEachChunk.
+class TextRope {
+public:
+    static const size_t CHUNK_SIZE = 4096;
+
+private:
+    friend class TextPool;
+
+    vector<shared_ptr<const string>> chunks;
+    string tail;  // незавершений останній фрагмент
+    size_t length = 0;
+
+    void seal() {
+        if (tail.empty()) return;
+        // Копія замість move: фрагмент займає рівно стільки, скільки тексту
+        chunks.push_back(shared_ptr<const string>(new string(tail)));
+        tail.clear();
+    }
+
+public:
+    TextRope() {}
+
+    TextRope(const string& text) {
+        append(text);
+    }
+
+    void append(const char* data, size_t size) {
+        length += size;
+        while (size > 0) {
+            size_t part = min(size, CHUNK_SIZE - tail.size());
+            tail.append(data, part);
+            data += part;
+            size -= part;
+            if (tail.size() == CHUNK_SIZE) seal();
+        }
+    }
+
+    void append(const string& text) {
+        append(text.data(), text.size());
+    }
+
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+
+    template <typename Visitor>
+    void forEachChunk(Visitor visit) const {
+        for (const auto& chunk : chunks) visit(chunk->data(), chunk->size());
+        if (!tail.empty()) visit(tail.data(), tail.size());
+    }
+
+    // Завершені фрагменти; у збереженому повідомленні це весь текст
+    const vector<shared_ptr<const string>>& getChunks() const {
+        return chunks;
+    }
+
+    size_t count(char ch) const {
+        size_t total = 0;
+        forEachChunk([&](const char* data, size_t size) {
+            total += std::count(data, data + size, ch);
+        });
+        return total;
+    }
+
+    string str() const {
+        string result;
+        result.reserve(length);
+        forEachChunk([&](const char* data, size_t size) { result.append(data, size); });
+        return result;
+    }
+
+    // Пам'ять самого rope без фрагментів, які можуть бути спільними
+    size_t ownBytes() const {
+        return chunks.capacity() * sizeof(shared_ptr<const string>) + tail.capacity();
+    }
+
+    size_t memoryUsage() const {
+        size_t total = ownBytes();
+        for (const auto& chunk : chunks) total += chunk->capacity();
+        return total;
+    }
+};
+
+// Один і той самий код обробляє і rope, і суцільний рядок (текст з архіву)
+template <typename Visitor>
+void forEachChunk(const string& text, Visitor visit) {
+    visit(text.data(), text.size());
+}
+
+template <typename Visitor>
+void forEachChunk(const TextRope& text, Visitor visit) {
+    text.forEachChunk(visit);
+}
+
+// Пошук без урахування регістру по фрагментах. Збіг може перетинати межу
+// фрагментів, тому між ними переноситься хвіст довжиною keyword - 1.
+// onMatch отримує позицію збігу і повертає false, щоб зупинити пошук.
+template <typename Text, typename OnMatch>
+void findIgnoreCase(const Text& text, const string& loweredKeyword, OnMatch onMatch) {
+    if (loweredKeyword.empty()) return;
+
+    string window;
+    size_t windowStart = 0;
+    bool stopped = false;
+
+    forEachChunk(text, [&](const char* data, size_t size) {
+        if (stopped) return;
+
+        window.append(data, size);
+        transform(window.end() - size, window.end(), window.end() - size, ::tolower);
+
+        for (size_t pos = window.find(loweredKeyword); pos != string::npos;
+            pos = window.find(loweredKeyword, pos + 1)) {
+            if (!onMatch(windowStart + pos)) {
+                stopped = true;
+                return;
+            }
+        }
+
+        size_t keep = min(window.size(), loweredKeyword.size() - 1);
+        windowStart += window.size() - keep;
+        window.erase(0, window.size() - keep);
+    });
+}
+
+// Перетворення тексту з розміткою *жирний* та _курсив_ на байти виводу:
+// текст разом з ESC-послідовностями кольорів і стилів. onChunk отримує
+// out після кожного фрагмента тексту — так вивід можна віддавати потоком.
+template <typename Text, typename OnChunk>
+void appendFormatted(string& out, const Text& text, WORD defaultColor, OnChunk onChunk) {
+    bool bold = false, italic = false;
+    char previous = 0;
+
+    forEachChunk(text, [&](const char* data, size_t size) {
+        // Звичайний текст між маркерами дописується одним шматком
+        size_t runStart = 0;
+        for (size_t i = 0; i < size; i++) {
+            char ch = data[i];
+            bool escaped = previous == '\\';
+            previous = ch;
+            if ((ch != '*' && ch != '_') || escaped) continue;
+
+            out.append(data + runStart, i - runStart);
+            runStart = i + 1;
+
+            if (ch == '*') {
+                bold = !bold;
+                out += colorSequence(bold ? 0 : defaultColor);
+            }
+            else {
+                italic = !italic;
+                out += italic ? "\033[3m" : "\033[0m";
+                if (!italic && bold) out += colorSequence(0);
+                else if (!italic) out += colorSequence(defaultColor);
+            }
+        }
+        out.append(data + runStart, size - runStart);
+        onChunk(out);
+    });
+
+    out += colorSequence(defaultColor);
+    out += "\033[0m\n";
+}
+
+template <typename Text>
+void appendFormatted(string& out, const Text& text, WORD defaultColor) {
+    appendFormatted(out, text, defaultColor, [](string&) {});
+}
+
+// Виведення тексту з розміткою *жирний* та _курсив_ потоком по
+// фрагментах: для багатомегабайтного тексту суцільний рядок не будується
+template <typename Text>
+void streamFormatted(const Text& text, WORD defaultColor) {
+    string out;
+    appendFormatted(out, text, defaultColor, [](string& pending) {
+        cout.write(pending.data(), pending.size());
+        pending.clear();
+    });
+    cout.write(out.data(), out.size());
+}
+
+// Виведення тексту з розміткою *жирний* та _курсив_
+template <typename Text>
+void applyFormatting(const Text& text) {
+    CONSOLE_SCREEN_BUFFER_INFO csbi;
+    GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi);
+    streamFormatted(text, csbi.wAttributes);
 }
 
+// Сховище унікальних текстів: однакові тексти повідомлень (сповіщення ботів,
+// шаблони, копіпаст) зберігаються один раз і спільно використовуються через
+// лічильник посилань. Ключ — хеш вмісту фрагмента, колізії розрізняються
+// порівнянням.
+class TextPool {
+private:
+    mutex lock;  // повідомлення можуть створюватися з кількох потоків
+    unordered_map<size_t, vector<weak_ptr<const string>>> buckets;
+    size_t entries = 0;
+    size_t pruneThreshold = 1024;
+
+    // Прибирає записи текстів, які вже ніхто не використовує
+    void prune() {
+        for (auto bucket = buckets.begin(); bucket != buckets.end();) {
+            auto& refs = bucket->second;
+            refs.erase(remove_if(refs.begin(), refs.end(),
+                [](const weak_ptr<const string>& ref) { return ref.expired(); }), refs.end());
+
+            if (refs.empty()) bucket = buckets.erase(bucket);
+            else ++bucket;
+        }
+
+        entries = 0;
+        for (const auto& bucket : buckets) entries += bucket.second.size();
+        pruneThreshold = max<size_t>(1024, entries * 2);
+    }
+
+    // Повертає вже відомий однаковий фрагмент або приймає цей у сховище.
+    // Фрагменти створюються без make_shared: інакше слабкі посилання
+    // тримали б пам'ять тексту
+    shared_ptr<const string> intern(const shared_ptr<const string>& chunk) {
+        auto& refs = buckets[hash<string>()(*chunk)];
+
+        for (auto it = refs.begin(); it != refs.end();) {
+            shared_ptr<const string> existing = it->lock();
+            if (!existing) {
+                it = refs.erase(it);
+                entries--;
+                continue;
+            }
+            if (*existing == *chunk) return existing;
+            ++it;
+        }
+
+        refs.push_back(chunk);
+        if (++entries > pruneThreshold) prune();
+        return chunk;
+    }
+
+public:
+    // Інтернує текст пофрагментно: однакові повідомлення, а також однакові
+    // фрагменти довгих текстів, зберігаються один раз
+    TextRope intern(TextRope text) {
+        text.seal();
+        lock_guard<mutex> guard(lock);
+        for (auto& chunk : text.chunks) chunk = intern(chunk);
+        return text;
+    }
+};
+
+// Домен RCU: читач без блокувань і повторів позначається в лічильнику
+// свого покоління на час читання. Писач, прибравши об'єкт з видимості,
+// викликає synchronize(): двічі перемикає покоління, щоразу чекаючи, доки
+// вийдуть читачі попереднього, — після цього прибране вже ніхто не читає
+// і його можна звільнити.
+class RcuDomain {
+private:
+    atomic<unsigned> generation{0};
+    mutable atomic<long> readers[2];
+
+public:
+    RcuDomain() {
+        readers[0] = 0;
+        readers[1] = 0;
+    }
+
+    RcuDomain(const RcuDomain&) = delete;
+    RcuDomain& operator=(const RcuDomain&) = delete;
+
+    // Ділянка читання; nullptr — домену немає, читати можна без позначки
+    class ReadGuard {
+    private:
+        const RcuDomain* domain;
+        unsigned parity = 0;
+
+    public:
+        explicit ReadGuard(const RcuDomain* readDomain)
+            : domain(readDomain)
+        {
+            if (!domain) return;
+            parity = domain->generation.load() & 1;
+            domain->readers[parity].fetch_add(1);
+        }
+
+        ~ReadGuard() {
+            if (domain) domain->readers[parity].fetch_sub(1);
+        }
+
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+    };
+
+    // Не можна викликати з ділянки читання цього ж домену
+    void synchronize() {
+        for (int phase = 0; phase < 2; phase++) {
+            unsigned parity = generation.fetch_add(1) & 1;
+            while (readers[parity].load() != 0) this_thread::yield();
+        }
+    }
+};
+
+// Вказівник на незмінну версію об'єкта для RCU: читач у домені копіює
+// shared_ptr, писач (лише один одночасно) підміняє обгортку й звільняє
+// стару після synchronize(). Сама версія живе, доки її тримає хоч один
+// знімок. atomic_load для shared_ptr у стандартних бібліотеках
+// реалізовано через блокування, тому не підходить.
+template <typename T>
+class RcuPointer {
+private:
+    atomic<const shared_ptr<T>*> current;
+    RcuDomain domain;
+
+public:
+    explicit RcuPointer(const shared_ptr<T>& initial)
+        : current(new shared_ptr<T>(initial)) {}
+
+    RcuPointer(const RcuPointer&) = delete;
+    RcuPointer& operator=(const RcuPointer&) = delete;
+
+    ~RcuPointer() {
+        delete current.load();
+    }
+
+    shared_ptr<T> load() const {
+        RcuDomain::ReadGuard guard(&domain);
+        return *current.load();
+    }
+
+    // Викликається лише під м'ютексом писачів
+    void store(const shared_ptr<T>& next) {
+        const shared_ptr<T>* previous = current.exchange(new shared_ptr<T>(next));
+        domain.synchronize();
+        delete previous;
+    }
+};
+
+// Файл кешу, куди MessageStorage витісняє тіла давно не використаних
+// повідомлень, коли перевищено бюджет пам'яті. Текст незмінний, тож кожне
+// тіло записується у файл один раз і при повторному витісненні просто
+// звільняється з пам'яті. Тут же ведеться облік резидентних байтів і
+// звернень до тіл. Файл створюється при першому витісненні й видаляється
+// разом з кешем.
+//
+// Облік ведеться по інтернованих фрагментах: фрагмент, спільний для кількох
+// повідомлень (див. TextPool), рахується один раз, а звільняється лише
+// тоді, коли витіснено всіх його власників.
+class BodyCache {
+private:
+    friend class Message;
+
+    static const size_t READ_BLOCK = 64 * 1024;
+
+    string path;
+    FILE* file = nullptr;
+    unsigned long long fileEnd = 0;
+    mutex lock;
+
+    mutex accountLock;
+    unordered_map<const string*, size_t> holders;  // фрагмент -> резидентних власників
+
+    // Тіла повідомлень цього кешу читаються в домені RCU; обгортки
+    // витіснених тіл чекають у retired, доки їх не звільнить reclaim()
+    RcuDomain domain;
+    mutex retireLock;
+    vector<const shared_ptr<const TextRope>*> retired;
+
+    void retire(const shared_ptr<const TextRope>* holder) {
+        lock_guard<mutex> guard(retireLock);
+        retired.push_back(holder);
+    }
+
+    // Викликаються під accountLock
+    void addChunks(const TextRope& body) {
+        residentBytes += body.ownBytes();
+        for (const auto& chunk : body.getChunks()) {
+            size_t bytes = chunk->capacity();
+            size_t& count = holders[chunk.get()];
+            if (++count == 1) {
+                residentBytes += bytes;
+                spillableBytes += bytes;
+            }
+            else if (count == 2) {
+                spillableBytes -= bytes;
+            }
+        }
+    }
+
+    // Повертає, скільки байтів справді звільниться разом з цим тілом
+    size_t removeChunks(const TextRope& body) {
+        size_t freed = body.ownBytes();
+        residentBytes -= freed;
+        for (const auto& chunk : body.getChunks()) {
+            size_t bytes = chunk->capacity();
+            auto holder = holders.find(chunk.get());
+            if (holder == holders.end()) continue;
+            if (--holder->second == 0) {
+                holders.erase(holder);
+                residentBytes -= bytes;
+                spillableBytes -= bytes;
+                freed += bytes;
+            }
+            else if (holder->second == 1) {
+                spillableBytes += bytes;
+            }
+        }
+        return freed;
+    }
+
+    // Чи є в тілі фрагменти, які тримає лише воно
+    bool ownsChunks(const TextRope& body) {
+        lock_guard<mutex> guard(accountLock);
+        for (const auto& chunk : body.getChunks()) {
+            auto holder = holders.find(chunk.get());
+            if (holder != holders.end() && holder->second == 1) return true;
+        }
+        return false;
+    }
+
+public:
+    atomic<size_t> residentBytes{0};   // унікальні резидентні фрагменти
+    atomic<size_t> spillableBytes{0};  // фрагменти з єдиним власником — їх звільнить витіснення
+    atomic<bool> failed{false};  // файл кешу не вдалося записати
+    atomic<size_t> hits{0};    // тіло було в пам'яті
+    atomic<size_t> misses{0};  // тіло зчитано з диска
+
+    explicit BodyCache(const string& spillPath)
+        : path(spillPath) {}
+
+    ~BodyCache() {
+        for (const auto* holder : retired) delete holder;
+        if (file) {
+            fclose(file);
+            remove(path.c_str());
+        }
+    }
+
+    BodyCache(const BodyCache&) = delete;
+    BodyCache& operator=(const BodyCache&) = delete;
+
+    // Звільняє тіла, витіснені з останнього виклику, коли їх уже не читає
+    // жоден читач. Викликає потік витіснення після серії spill().
+    void reclaim() {
+        vector<const shared_ptr<const TextRope>*> batch;
+        {
+            lock_guard<mutex> guard(retireLock);
+            batch.swap(retired);
+        }
+        if (batch.empty()) return;
+        domain.synchronize();
+        for (const auto* holder : batch) delete holder;
+    }
+
+    // Дописує тіло в кінець файлу; offset — де його шукати згодом
+    bool store(const TextRope& body, unsigned long long& offset) {
+        lock_guard<mutex> guard(lock);
+        if (!file) {
+            file = fopen(path.c_str(), "w+b");
+            if (!file) {
+                failed = true;
+                return false;
+            }
+        }
+
+        bool written = _fseeki64(file, static_cast<long long>(fileEnd), SEEK_SET) == 0;
+        body.forEachChunk([&](const char* data, size_t size) {
+            if (written && fwrite(data, 1, size, file) != size) written = false;
+        });
+        if (!written) {
+            failed = true;
+            return false;
+        }
+
+        offset = fileEnd;
+        fileEnd += body.size();
+        return true;
+    }
+
+    TextRope load(unsigned long long offset, size_t length) {
+        TextRope body;
+        vector<char> block(length < READ_BLOCK ? length : READ_BLOCK);
+
+        lock_guard<mutex> guard(lock);
+        if (!file || _fseeki64(file, static_cast<long long>(offset), SEEK_SET) != 0) return body;
+
+        while (length > 0) {
+            size_t got = fread(block.data(), 1, min(length, block.size()), file);
+            if (got == 0) break;
+            body.append(block.data(), got);
+            length -= got;
+        }
+        return body;
+    }
+};
+
+// Точка втручання для стрес-тестів (tests/stress_tsan.cpp): викликається
+// в Message::spill() одразу після підміни тіла, ще під замком обліку
+#ifndef SPILL_SWAP_HOOK
+#define SPILL_SWAP_HOOK(message)
+#endif
+
 class Message {
 protected:
-    static int global_id_counter;
+    static atomic<int> global_id_counter;
+    static atomic<unsigned long long> accessClock;
+    static atomic<unsigned long long> versionCounter;
+    static TextPool textPool;
     int id;
-    string text;
+
+    // Кожен об'єкт повідомлення незмінний, тож нова версія (редагування,
+    // декоратор) — це новий об'єкт з новим номером
+    unsigned long long version = ++versionCounter;
+
+    // Тіло повідомлення. Коли MessageStorage витісняє його на диск, тут
+    // лишається nullptr, а в пам'яті — тільки ID і зміщення у файлі кешу.
+    // Витіснення й підвантаження йдуть паралельно з читанням, тож обгортка
+    // читається в домені RCU кешу без блокувань, а витіснена звільняється
+    // лише після BodyCache::reclaim(). Непрощене повідомлення ще не має
+    // кешу, а отже й писачів — його тіло читається напряму.
+    mutable atomic<const shared_ptr<const TextRope>*> body;
+    shared_ptr<BodyCache> cache;
+    bool spilled = false;
+    unsigned long long spillOffset = 0;
+    size_t spillLength = 0;
+    mutable atomic<unsigned long long> lastAccess{0};
+
+    // Тіло, враховане в обліку кешу; захищене cache->accountLock.
+    // detached — повідомлення вилучене зі сховища: його підвантаження
+    // зі старих знімків більше не рахуються.
+    mutable shared_ptr<const TextRope> countedBody;
+    bool detached = false;
+
+    const RcuDomain* readDomain() const {
+        return cache ? &cache->domain : nullptr;
+    }
+
+    // Поточне тіло або nullptr; лише в ділянці читання readDomain()
+    shared_ptr<const TextRope> residentBody() const {
+        const shared_ptr<const TextRope>* holder = body.load();
+        return holder ? *holder : shared_ptr<const TextRope>();
+    }
+
+    // Викликається в ділянці читання readDomain()
+    void track(const shared_ptr<const TextRope>& current) const {
+        if (!cache || !current) return;
+        lock_guard<mutex> guard(cache->accountLock);
+        // Тіло могли витіснити, поки воно ще не було враховане
+        if (detached || countedBody || residentBody() != current) return;
+        countedBody = current;
+        cache->addChunks(*current);
+    }
+
+    shared_ptr<const TextRope> loadBody() const {
+        return make_shared<const TextRope>(textPool.intern(cache->load(spillOffset, spillLength)));
+    }
 
 public:
-    Message(const string& txt)
-        : text(txt), id(++global_id_counter) {}
+    Message(const TextRope& txt)
+        : body(new shared_ptr<const TextRope>(make_shared<const TextRope>(textPool.intern(txt)))),
+        id(++global_id_counter) {}
 
-    Message(const string& txt, int forcedId)
-        : text(txt), id(forcedId)
+    Message(const TextRope& txt, int forcedId)
+        : body(new shared_ptr<const TextRope>(make_shared<const TextRope>(textPool.intern(txt)))),
+        id(forcedId)
     {
-        if (forcedId > global_id_counter) {
-            global_id_counter = forcedId;
-        }
+        raiseGlobalCounter(forcedId);
     }
 
-    virtual ~Message() {}
+    // Для декораторів: тіло спільне з обгорнутим повідомленням
+    Message(const Message& other)
+        : id(other.id), body(new shared_ptr<const TextRope>(other.getBody())) {}
+
+    virtual ~Message() {
+        delete body.load();
+    }
 
     void setId(int newId) { id = newId; }
     int getId() const { return id; }
@@ -57,16 +735,127 @@ public:
     static int getGlobalCounter() { return global_id_counter; }
     static void setGlobalCounter(int value) { global_id_counter = value; }
 
+    // Піднімає лічильник до value, якщо він менший; безпечно з кількох потоків
+    static void raiseGlobalCounter(int value) {
+        int current = global_id_counter.load();
+        while (current < value && !global_id_counter.compare_exchange_weak(current, value)) {}
+    }
+
     virtual string getText() const {
-        return text;
+        return getBody()->str();
+    }
+
+    // Тіло повідомлення; витіснене тіло прозоро підвантажується з диска
+    shared_ptr<const TextRope> getBody() const {
+        lastAccess.store(++accessClock, memory_order_relaxed);
+
+        RcuDomain::ReadGuard guard(readDomain());
+        shared_ptr<const TextRope> current = residentBody();
+        if (current) {
+            if (cache) cache->hits++;
+            return current;
+        }
+
+        cache->misses++;
+        shared_ptr<const TextRope> loaded = loadBody();
+        const shared_ptr<const TextRope>* expected = nullptr;
+        const shared_ptr<const TextRope>* holder = new shared_ptr<const TextRope>(loaded);
+        if (!body.compare_exchange_strong(expected, holder)) {
+            delete holder;
+            return *expected; // інший потік підвантажив тіло раніше
+        }
+        track(loaded);
+        return loaded;
+    }
+
+    // Тіло для повного проходу (пошук, статистика, збереження): витіснене
+    // тіло читається тимчасово й не повертається в пам'ять, щоб один прохід
+    // не виштовхнув з кешу все, з чим користувач працює. У статистиці
+    // звернень такі читання не враховуються.
+    shared_ptr<const TextRope> scanBody() const {
+        shared_ptr<const TextRope> current;
+        {
+            RcuDomain::ReadGuard guard(readDomain());
+            current = residentBody();
+        }
+        return current ? current : loadBody();
+    }
+
+    // Прив'язує повідомлення до кешу сховища, яке ним володіє
+    void attach(const shared_ptr<BodyCache>& storageCache) {
+        if (cache) return;
+        cache = storageCache;
+        RcuDomain::ReadGuard guard(readDomain());
+        track(residentBody());
+    }
+
+    // Повідомлення вилучене зі сховища (видалення, заміна): його тіло
+    // більше не рахується як резидентне
+    void detach() {
+        if (!cache) return;
+        lock_guard<mutex> guard(cache->accountLock);
+        detached = true;
+        if (countedBody) cache->removeChunks(*countedBody);
+        countedBody.reset();
+    }
+
+    // Скільки байтів тіла зараз у пам'яті (0 — тіло витіснене)
+    size_t residentBodyBytes() const {
+        RcuDomain::ReadGuard guard(readDomain());
+        const shared_ptr<const TextRope>* holder = body.load();
+        return holder ? (*holder)->memoryUsage() : 0;
+    }
+
+    unsigned long long getLastAccess() const {
+        return lastAccess.load(memory_order_relaxed);
+    }
+
+    // Витісняє тіло на диск; повертає кількість звільнених байтів. Пам'ять
+    // звільняється з наступним BodyCache::reclaim(). Викликається лише одним
+    // потоком витіснення одночасно: прибирає обгортку тіла тільки він, тож
+    // читати її тут можна без ділянки читання. Тіло, всі фрагменти якого
+    // спільні з іншими резидентними тілами, не витісняється: пам'яті це не
+    // звільнить, а у файл кешу ліг би ще один дублікат.
+    size_t spill() {
+        const shared_ptr<const TextRope>* holder = body.load();
+        if (!holder || !cache || (*holder)->empty()) return 0;
+        shared_ptr<const TextRope> current = *holder;
+        if (!cache->ownsChunks(*current)) return 0;
+
+        if (!spilled) {
+            if (!cache->store(*current, spillOffset)) return 0;
+            spillLength = current->size();
+            spilled = true;
+        }
+
+        // Підміна й зняття з обліку — під тим самим замком, що й track():
+        // тіло, яке читач підвантажить одразу після підміни, буде враховане
+        // вже після того, як знято облік старого
+        lock_guard<mutex> guard(cache->accountLock);
+        if (!body.compare_exchange_strong(holder, nullptr)) return 0;
+        cache->retire(holder);
+        SPILL_SWAP_HOOK(*this);
+        if (countedBody != current) return 0;
+        countedBody.reset();
+        return cache->removeChunks(*current);
+    }
+
+    unsigned long long getVersion() const {
+        return version;
     }
 
     virtual string getType() const {
         return "Просте";
     }
 
+    // Готові байти для консолі: текст з ESC-послідовностями кольорів
+    virtual string render() const {
+        return "ID: " + to_string(id) + " - " + getText() + "\n";
+    }
+
     virtual void display() const {
-        cout << "ID: " << id << " - " << getText() << endl;
+        string bytes = render();
+        cout.write(bytes.data(), bytes.size());
     }
 
     bool operator<(const Message& other) const {
@@ -74,51 +863,32 @@ public:
     }
 };
 
-int Message::global_id_counter = 0;
+atomic<int> Message::global_id_counter(0);
+atomic<unsigned long long> Message::accessClock(0);
+atomic<unsigned long long> Message::versionCounter(0);
+TextPool Message::textPool;
 
 class SimpleMessage : public Message {
 public:
-    SimpleMessage(const string& txt)
+    SimpleMessage(const TextRope& txt)
         : Message(txt) {}
 
-    SimpleMessage(const string& txt, int forcedId)
+    SimpleMessage(const TextRope& txt, int forcedId)
         : Message(txt, forcedId) {}
 
-    void display() const override {
-        setConsoleColor(8); 
-        cout << "ID: " << getId() << " - ";
-        string rawText = this->getText();
-        applyFormatting(rawText);
-        setConsoleColor(8);
+    string render() const override {
+        string out = colorSequence(8);
+        out += "ID: " + to_string(getId()) + " - ";
+        appendFormatted(out, *getBody(), 8);
+        out += colorSequence(8);
+        return out;
     }
 
-protected:
-    void applyFormatting(const string& text) const {
-        HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-        CONSOLE_SCREEN_BUFFER_INFO csbi;
-        GetConsoleScreenBufferInfo(hConsole, &csbi);
-        WORD defaultColor = csbi.wAttributes;
-
-        bool bold = false, italic = false;
-
-        for (size_t i = 0; i < text.length(); i++) {
-            if (text[i] == '*' && (i == 0 || text[i - 1] != '\\')) {
-                bold = !bold;
-                setConsoleColor(bold ? 0 : defaultColor);
-                continue;
-            }
-            if (text[i] == '_' && (i == 0 || text[i - 1] != '\\')) {
-                italic = !italic;
-                cout << (italic ? "\033[3m" : "\033[0m");
-                if (!italic && bold) setConsoleColor(0);
-                else if (!italic) setConsoleColor(defaultColor);
-                continue;
-            }
-            cout << text[i];
-        }
-
-        setConsoleColor(defaultColor);
-        cout << "\033[0m" << endl;
+    // Ті самі байти, що й render(), але потоком по фрагментах rope
+    void display() const override {
+        cout << colorSequence(8) << "ID: " << getId() << " - ";
+        streamFormatted(*getBody(), 8);
+        cout << colorSequence(8);
     }
 };
 
@@ -127,15 +897,16 @@ protected:
     shared_ptr<Message> wrappedMessage;
 
 public:
+    // Текст не копіюється, а ділиться з обгорнутим повідомленням
     MessageDecorator(shared_ptr<Message> msg)
-        : Message(msg->getText(), msg->getId()), wrappedMessage(msg) {}
+        : Message(*msg), wrappedMessage(msg) {}
 
     string getText() const override {
         return wrappedMessage->getText();
     }
 
-    virtual void display() const override {
-        wrappedMessage->display();
+    virtual string render() const override {
+        return wrappedMessage->render();
     }
 };
 
@@ -148,11 +919,9 @@ public:
         return "Bold";
     }
 
-    void display() const override {
-        setConsoleColor(0xF0);
-        cout << "ID: " << getId() << " - " << getText() << endl;
-        setConsoleColor(8);
-
+    string render() const override {
+        return colorSequence(0xF0) + "ID: " + to_string(getId()) + " - " + getText() + "\n"
+            + colorSequence(8);
     }
 };
 
@@ -164,74 +933,311 @@ public:
         return "Italic";
     }
 
-    void display() const override {
-        setConsoleColor(8);
-        cout << "ID: " << getId() << " - " << "\033[3m" << getText() << "\033[0m" << endl;
-        setConsoleColor(8);
-
+    string render() const override {
+        return colorSequence(8) + "ID: " + to_string(getId()) + " - " + "\033[3m" + getText() + "\033[0m\n"
+            + colorSequence(8);
     }
 };
 
 struct MessageComparator {
+    // Дозволяє шукати у відсортованих діапазонах безпосередньо за ID
+    using is_transparent = void;
+
     bool operator()(const shared_ptr<Message>& lhs, const shared_ptr<Message>& rhs) const {
         return lhs->getId() < rhs->getId(); 
     }
+
+    bool operator()(const shared_ptr<Message>& lhs, int rhsId) const {
+        return lhs->getId() < rhsId;
+    }
+
+    bool operator()(int lhsId, const shared_ptr<Message>& rhs) const {
+        return lhsId < rhs->getId();
+    }
 };
 
-void highlightMatch(const string& text, const string& keyword, int id) {
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    CONSOLE_SCREEN_BUFFER_INFO csbi;
-    GetConsoleScreenBufferInfo(hConsole, &csbi);
-    WORD defaultColor = csbi.wAttributes;
-    WORD boldColor = 0x00; // чорний текст (білий фон — за замовчуванням)
-    WORD highlightColor = BACKGROUND_RED | BACKGROUND_GREEN; // жовтий фон
+// Незмінна впорядкована за ID множина повідомлень: AVL-дерево з
+// копіюванням шляху. Вставка, заміна й видалення повертають нову множину,
+// у якій скопійовано лише O(log n) вузлів від кореня до зміненого місця,
+// а решта піддерев спільна зі старою версією. Тож запис не копіює всю
+// переписку, а старі версії лишаються цілими для читачів, що їх тримають.
+class MessageSet {
+private:
+    struct Node;
+    typedef shared_ptr<const Node> Link;
 
-    // Зниження регістру для пошуку збігу
-    string loweredText = text;
-    string loweredKeyword = keyword;
-    transform(loweredText.begin(), loweredText.end(), loweredText.begin(), ::tolower);
-    transform(loweredKeyword.begin(), loweredKeyword.end(), loweredKeyword.begin(), ::tolower);
+    struct Node {
+        shared_ptr<Message> msg;
+        Link left, right;
+        int height;
+        size_t count;
 
-    cout << "ID: " << id << " - ";
+        Node(const Link& l, const shared_ptr<Message>& m, const Link& r)
+            : msg(m), left(l), right(r),
+            height(1 + max(heightOf(l), heightOf(r))),
+            count(1 + countOf(l) + countOf(r)) {}
+    };
 
-    bool bold = false;
-    bool italic = false;
+    // Висота AVL-дерева не перевищує 1.44·log2(n), тож 64 рівнів досить
+    // для будь-якої переписки, що вміщується в пам'ять
+    static const int MAX_DEPTH = 64;
 
-    for (size_t i = 0; i < text.length(); ++i) {
-        // ФОРМАТУВАННЯ: жирний *
-        if (text[i] == '*' && (i == 0 || text[i - 1] != '\\')) {
-            bold = !bold;
-            SetConsoleTextAttribute(hConsole, bold ? boldColor : defaultColor);
-            continue;
+    Link root;
+
+    explicit MessageSet(const Link& top) : root(top) {}
+
+    static int heightOf(const Link& node) { return node ? node->height : 0; }
+    static size_t countOf(const Link& node) { return node ? node->count : 0; }
+
+    static Link make(const Link& l, const shared_ptr<Message>& msg, const Link& r) {
+        return make_shared<const Node>(l, msg, r);
+    }
+
+    // Новий вузол з відновленням балансу (різниця висот після однієї
+    // вставки чи видалення — не більше 2)
+    static Link balance(const Link& l, const shared_ptr<Message>& msg, const Link& r) {
+        int hl = heightOf(l), hr = heightOf(r);
+        if (hl > hr + 1) {
+            if (heightOf(l->left) >= heightOf(l->right)) {
+                return make(l->left, l->msg, make(l->right, msg, r));
+            }
+            return make(make(l->left, l->msg, l->right->left), l->right->msg,
+                make(l->right->right, msg, r));
+        }
+        if (hr > hl + 1) {
+            if (heightOf(r->right) >= heightOf(r->left)) {
+                return make(make(l, msg, r->left), r->msg, r->right);
+            }
+            return make(make(l, msg, r->left->left), r->left->msg,
+                make(r->left->right, r->msg, r->right));
         }
+        return make(l, msg, r);
+    }
 
-        // ФОРМАТУВАННЯ: курсив _
-        if (text[i] == '_' && (i == 0 || text[i - 1] != '\\')) {
-            italic = !italic;
-            cout << (italic ? "\033[3m" : "\033[0m");
-            if (!italic && bold) SetConsoleTextAttribute(hConsole, boldColor);
-            else if (!italic) SetConsoleTextAttribute(hConsole, defaultColor);
-            continue;
+    // Вставка; повідомлення з тим самим ID замінюється
+    static Link insert(const Link& node, const shared_ptr<Message>& msg) {
+        if (!node) return make(Link(), msg, Link());
+        int id = msg->getId(), own = node->msg->getId();
+        if (id < own) return balance(insert(node->left, msg), node->msg, node->right);
+        if (id > own) return balance(node->left, node->msg, insert(node->right, msg));
+        return make(node->left, msg, node->right);
+    }
+
+    static Link removeMin(const Link& node, shared_ptr<Message>& minimum) {
+        if (!node->left) {
+            minimum = node->msg;
+            return node->right;
+        }
+        return balance(removeMin(node->left, minimum), node->msg, node->right);
+    }
+
+    static Link erase(const Link& node, int id) {
+        if (!node) return node;
+        int own = node->msg->getId();
+        if (id < own) return balance(erase(node->left, id), node->msg, node->right);
+        if (id > own) return balance(node->left, node->msg, erase(node->right, id));
+        if (!node->left) return node->right;
+        if (!node->right) return node->left;
+
+        shared_ptr<Message> successor;
+        Link right = removeMin(node->right, successor);
+        return balance(node->left, successor, right);
+    }
+
+    template <typename It>
+    static Link build(It first, size_t count) {
+        if (count == 0) return Link();
+        size_t half = count / 2;
+        It middle = first;
+        advance(middle, half);
+        It after = middle;
+        ++after;
+        return make(build(first, half), *middle, build(after, count - half - 1));
+    }
+
+public:
+    // Ітератор у порядку зростання ID: стек вузлів, у яких ще не пройдено
+    // праве піддерево. Дійсний, поки жива множина, з якої його отримано.
+    class const_iterator {
+    private:
+        friend class MessageSet;
+        const Node* path[MAX_DEPTH];
+        int depth = 0;
+
+        void descendLeft(const Node* node) {
+            for (; node; node = node->left.get()) path[depth++] = node;
         }
 
-        // Пошук збігу з keyword (без урахування регістру)
-        size_t remaining = text.length() - i;
-        if (remaining >= keyword.length()) {
-            string sub = loweredText.substr(i, keyword.length());
-            if (sub == loweredKeyword) {
-                SetConsoleTextAttribute(hConsole, highlightColor);
-                for (size_t j = 0; j < keyword.length(); ++j, ++i) {
-                    cout << text[i];
+    public:
+        typedef forward_iterator_tag iterator_category;
+        typedef shared_ptr<Message> value_type;
+        typedef ptrdiff_t difference_type;
+        typedef const shared_ptr<Message>* pointer;
+        typedef const shared_ptr<Message>& reference;
+
+        reference operator*() const { return path[depth - 1]->msg; }
+        pointer operator->() const { return &path[depth - 1]->msg; }
+
+        const_iterator& operator++() {
+            const Node* node = path[--depth];
+            descendLeft(node->right.get());
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            const_iterator previous = *this;
+            ++*this;
+            return previous;
+        }
+
+        bool operator==(const const_iterator& other) const {
+            if (depth == 0 || other.depth == 0) return depth == other.depth;
+            return path[depth - 1] == other.path[other.depth - 1];
+        }
+
+        bool operator!=(const const_iterator& other) const { return !(*this == other); }
+    };
+    typedef const_iterator iterator;
+
+    MessageSet() {}
+
+    // Побудова з відсортованого за ID діапазону без повторів: ідеально
+    // збалансоване дерево за лінійний час
+    template <typename It>
+    MessageSet(It first, It last)
+        : root(build(first, static_cast<size_t>(distance(first, last)))) {}
+
+    size_t size() const { return countOf(root); }
+    bool empty() const { return !root; }
+
+    const_iterator begin() const {
+        const_iterator it;
+        it.descendLeft(root.get());
+        return it;
+    }
+
+    const_iterator end() const { return const_iterator(); }
+
+    // Перше повідомлення з ID >= id (strict — з ID > id)
+    const_iterator lower_bound(int id, bool strict = false) const {
+        const_iterator it;
+        for (const Node* node = root.get(); node;) {
+            int own = node->msg->getId();
+            if (own > id || (own == id && !strict)) {
+                it.path[it.depth++] = node;
+                node = node->left.get();
+            }
+            else {
+                node = node->right.get();
+            }
+        }
+        return it;
+    }
+
+    const_iterator upper_bound(int id) const { return lower_bound(id, true); }
+
+    const_iterator find(int id) const {
+        const_iterator it = lower_bound(id);
+        return (it != end() && (*it)->getId() == id) ? it : end();
+    }
+
+    size_t count(int id) const { return find(id) != end() ? 1 : 0; }
+
+    // Повідомлення з найбільшим ID; множина не порожня
+    const shared_ptr<Message>& back() const {
+        const Node* node = root.get();
+        while (node->right) node = node->right.get();
+        return node->msg;
+    }
+
+    // Нова версія з доданим або заміненим повідомленням
+    MessageSet with(const shared_ptr<Message>& msg) const {
+        return MessageSet(insert(root, msg));
+    }
+
+    // Нова версія без повідомлення з цим ID
+    MessageSet without(int id) const {
+        return MessageSet(erase(root, id));
+    }
+};
+
+// Незмінна версія переписки, яку читач тримає стільки, скільки потрібно
+typedef shared_ptr<const MessageSet> MessageSnapshot;
+
+template <typename Text>
+void highlightMatch(const Text& text, const string& keyword, int id) {
+    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+    CONSOLE_SCREEN_BUFFER_INFO csbi;
+    GetConsoleScreenBufferInfo(hConsole, &csbi);
+    WORD defaultColor = csbi.wAttributes;
+    WORD boldColor = 0x00; // чорний текст (білий фон — за замовчуванням)
+    WORD highlightColor = BACKGROUND_RED | BACKGROUND_GREEN; // жовтий фон
+
+    // Позиції збігів (без урахування регістру) знаходимо заздалегідь,
+    // щоб не тримати знижену копію всього тексту
+    string loweredKeyword = keyword;
+    transform(loweredKeyword.begin(), loweredKeyword.end(), loweredKeyword.begin(), ::tolower);
+    vector<size_t> matches;
+    findIgnoreCase(text, loweredKeyword, [&](size_t pos) {
+        matches.push_back(pos);
+        return true;
+    });
+
+    cout << "ID: " << id << " - ";
+
+    bool bold = false;
+    bool italic = false;
+    char previous = 0;
+    size_t pos = 0, nextMatch = 0, highlightLeft = 0;
+
+    forEachChunk(text, [&](const char* data, size_t size) {
+        for (size_t i = 0; i < size; ++i, ++pos) {
+            char ch = data[i];
+            bool escaped = previous == '\\';
+            previous = ch;
+
+            // Усередині підсвіченого збігу символи виводяться як є
+            if (highlightLeft > 0) {
+                cout << ch;
+                if (--highlightLeft == 0) {
+                    SetConsoleTextAttribute(hConsole, bold ? boldColor : defaultColor);
+                    if (italic) cout << "\033[3m";
                 }
-                --i; // компенсуємо зайвий ++ у циклі
+                continue;
+            }
+
+            // ФОРМАТУВАННЯ: жирний *
+            if (ch == '*' && !escaped) {
+                bold = !bold;
                 SetConsoleTextAttribute(hConsole, bold ? boldColor : defaultColor);
-                if (italic) cout << "\033[3m";
                 continue;
             }
-        }
 
-        cout << text[i];
-    }
+            // ФОРМАТУВАННЯ: курсив _
+            if (ch == '_' && !escaped) {
+                italic = !italic;
+                cout << (italic ? "\033[3m" : "\033[0m");
+                if (!italic && bold) SetConsoleTextAttribute(hConsole, boldColor);
+                else if (!italic) SetConsoleTextAttribute(hConsole, defaultColor);
+                continue;
+            }
+
+            // Початок збігу з keyword
+            while (nextMatch < matches.size() && matches[nextMatch] < pos) nextMatch++;
+            if (nextMatch < matches.size() && matches[nextMatch] == pos) {
+                SetConsoleTextAttribute(hConsole, highlightColor);
+                cout << ch;
+                highlightLeft = keyword.length() - 1;
+                if (highlightLeft == 0) {
+                    SetConsoleTextAttribute(hConsole, bold ? boldColor : defaultColor);
+                    if (italic) cout << "\033[3m";
+                }
+                continue;
+            }
+
+            cout << ch;
+        }
+    });
 
     // Скидання кольорів і стилів
     SetConsoleTextAttribute(hConsole, defaultColor);
@@ -242,434 +1248,2499 @@ void highlightMatch(const string& text, const string& keyword, int id) {
     cout << "+----------------------------------+" << endl;
 }
 
+// Текст повідомлення безпосередньо у відображеному файлі: ділянки між
+// \\n віддаються без копіювання, а кожне \\n — як справжній перенос
+struct ArchiveText {
+    const char* data;
+    size_t length;  // байтів у файлі, разом з \\n
+
+    size_t size() const {
+        size_t escapes = 0;
+        forEachChunk([&](const char* chunk, size_t part) {
+            if (part == 1 && *chunk == '\n') escapes++;
+        });
+        return length - escapes;
+    }
+
+    template <typename Visitor>
+    void forEachChunk(Visitor visit) const {
+        const char* end = data + length;
+        const char* run = data;
+        const char* p = data;
+        while (p < end) {
+            const char* slash = static_cast<const char*>(memchr(p, '\\', end - p));
+            if (!slash) break;
+            if (slash + 1 < end && slash[1] == 'n') {
+                if (slash > run) visit(run, static_cast<size_t>(slash - run));
+                visit("\n", 1);
+                p = run = slash + 2;
+            }
+            else {
+                p = slash + 1;
+            }
+        }
+        if (end > run) visit(run, static_cast<size_t>(end - run));
+    }
+
+    // Копія у вигляді rope — лише для тексту, який треба віддати далі
+    TextRope rope() const {
+        TextRope text;
+        forEachChunk([&](const char* chunk, size_t part) { text.append(chunk, part); });
+        return text;
+    }
+};
+
+template <typename Visitor>
+void forEachChunk(const ArchiveText& text, Visitor visit) {
+    text.forEachChunk(visit);
+}
+
+// Режим лише для читання для великих архівів: файл історії відображається
+// в пам'ять, а в купі тримається тільки компактна таблиця зміщень
+// (ID -> діапазон байтів тексту). Текст читається прямо з відображення.
+class MappedHistory {
+private:
+    struct Entry {
+        unsigned long long offset;
+        unsigned int length;
+        int id;
+    };
+
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+    const char* data = nullptr;
+    unsigned long long size = 0;
+    vector<Entry> entries;
+
+    void buildIndex() {
+        const char* end = data + size;
+        const char* line = data;
+
+        while (line < end) {
+            const char* newline = static_cast<const char*>(memchr(line, '\n', end - line));
+            const char* lineEnd = newline ? newline : end;
+            const char* textEnd = (lineEnd > line && lineEnd[-1] == '\r') ? lineEnd - 1 : lineEnd;
+
+            // Формат рядка такий самий, як у saveToFile: "ID: n|текст"
+            const char* delim = static_cast<const char*>(memchr(line, '|', textEnd - line));
+            const char* colon = delim ? static_cast<const char*>(memchr(line, ':', delim - line)) : nullptr;
+
+            if (colon) {
+                const char* p = colon + 1;
+                while (p < delim && *p == ' ') p++;
+
+                // ID поза межами int відкидається, як і stoi у parseHistoryLine
+                int id = 0;
+                bool valid = p < delim;
+                for (; p < delim && valid; p++) {
+                    if (*p < '0' || *p > '9') valid = false;
+                    else if (id > (INT_MAX - (*p - '0')) / 10) valid = false;
+                    else id = id * 10 + (*p - '0');
+                }
+
+                if (valid) {
+                    Entry entry;
+                    entry.offset = (delim + 1) - data;
+                    entry.length = static_cast<unsigned int>(textEnd - (delim + 1));
+                    entry.id = id;
+                    entries.push_back(entry);
+                }
+            }
+
+            line = lineEnd + 1;
+        }
+    }
+
+public:
+    MappedHistory() {}
+    MappedHistory(const MappedHistory&) = delete;
+    MappedHistory& operator=(const MappedHistory&) = delete;
+
+    ~MappedHistory() {
+        close();
+    }
+
+    bool open(const string& path) {
+        close();
+
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) return false;
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize)) {
+            close();
+            return false;
+        }
+        size = static_cast<unsigned long long>(fileSize.QuadPart);
+
+        // Порожній файл не можна відобразити — це просто порожній архів
+        if (size == 0) return true;
+
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL) {
+            close();
+            return false;
+        }
+
+        data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        if (data == nullptr) {
+            close();
+            return false;
+        }
+
+        buildIndex();
+        return true;
+    }
+
+    void close() {
+        if (data) UnmapViewOfFile(data);
+        if (mapping != NULL) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        data = nullptr;
+        mapping = NULL;
+        file = INVALID_HANDLE_VALUE;
+        size = 0;
+        entries.clear();
+    }
+
+    size_t count() const { return entries.size(); }
+
+    size_t indexBytes() const { return entries.capacity() * sizeof(Entry); }
+
+    int idAt(size_t index) const { return entries[index].id; }
+
+    // Текст без копіювання — для потокової обробки (показ, статистика, експорт)
+    ArchiveText textView(size_t index) const {
+        ArchiveText text = { data + entries[index].offset, entries[index].length };
+        return text;
+    }
+};
+
+
+// Ледачий курсор пошуку: переглядає знімок переписки або архів по одному
+// повідомленню з місця, де зупинився, тож сторінка результатів коштує
+// лише той відрізок, який довелося переглянути до її заповнення. Перші
+// offset збігів пропускаються. Знімок (чи відображення архіву) тримається
+// весь час, тому наступні сторінки узгоджені з першою навіть після змін.
+class SearchCursor {
+private:
+    MessageSnapshot current;
+    MessageSet::const_iterator position;
+    shared_ptr<const MappedHistory> archive;  // у режимі архіву — перегляд за індексом, current порожній
+    size_t archiveIndex = 0;
+    string loweredKeyword;
+    size_t toSkip;
+    size_t scannedCount = 0;
+    size_t matchedCount = 0;
+
+    // Досить першого збігу; текст переглядається по фрагментах
+    template <typename Text>
+    bool accept(const Text& text) {
+        bool found = false;
+        findIgnoreCase(text, loweredKeyword, [&](size_t) {
+            found = true;
+            return false;
+        });
+        if (!found) return false;
+        if (toSkip > 0) {
+            toSkip--;
+            return false;
+        }
+        matchedCount++;
+        return true;
+    }
+
+public:
+    SearchCursor(const MessageSnapshot& snapshot, const string& keyword, size_t offset = 0)
+        : current(snapshot), position(snapshot->begin()), loweredKeyword(keyword), toSkip(offset)
+    {
+        transform(loweredKeyword.begin(), loweredKeyword.end(), loweredKeyword.begin(), ::tolower);
+    }
+
+    SearchCursor(const shared_ptr<const MappedHistory>& mapped, const string& keyword, size_t offset = 0)
+        : archive(mapped), loweredKeyword(keyword), toSkip(offset)
+    {
+        transform(loweredKeyword.begin(), loweredKeyword.end(), loweredKeyword.begin(), ::tolower);
+    }
+
+    // Переглядає одне повідомлення; для збігу викликає onMatch(текст, ID)
+    // і повертає true. Текст архіву переглядається прямо у відображенні й
+    // копіюється лише для збігу; витіснене тіло читається з диска один раз
+    // і в пам'ять не повертається.
+    template <typename OnMatch>
+    bool advance(OnMatch onMatch) {
+        if (exhausted()) return false;
+        scannedCount++;
+
+        if (archive) {
+            size_t index = archiveIndex++;
+            ArchiveText text = archive->textView(index);
+            if (!accept(text)) return false;
+            onMatch(text.rope(), archive->idAt(index));
+            return true;
+        }
+
+        const shared_ptr<Message>& msg = *position++;
+        shared_ptr<const TextRope> body = msg->scanBody();
+        if (!accept(*body)) return false;
+        onMatch(*body, msg->getId());
+        return true;
+    }
+
+    bool exhausted() const {
+        return archive ? archiveIndex == archive->count() : position == current->end();
+    }
+    size_t remaining() const { return (archive ? archive->count() : current->size()) - scannedCount; }
+    size_t matched() const { return matchedCount; }
+};
+
+
+bool isCancelled(const string& input) {
+    return input == "/cancel";
+}
+
+// Довга операція (завантаження, збереження, пошук), розбита на короткі кроки,
+// між якими цикл runTask обробляє введення користувача
+class CancellableTask {
+public:
+    virtual ~CancellableTask() {}
+
+    // Виконує порцію роботи; повертає false, коли роботу завершено
+    virtual bool step() = 0;
+
+    // Прогрес у відсотках
+    virtual int progress() const = 0;
+};
+
+// Задача, що виконує work() порціями по batchSize викликів.
+// work() обробляє один елемент і повертає кількість опрацьованих одиниць
+// (елементів або байтів) із total; 0 означає, що роботи більше немає.
+class ChunkedTask : public CancellableTask {
+private:
+    size_t total;
+    size_t done = 0;
+    size_t batchSize;
+    function<size_t()> work;
+
+public:
+    ChunkedTask(size_t totalUnits, function<size_t()> workItem, size_t batch = 1024)
+        : total(totalUnits), batchSize(batch), work(workItem) {}
+
+    bool step() override {
+        for (size_t i = 0; i < batchSize; i++) {
+            if (done >= total) return false;
+
+            size_t processed = work();
+            if (processed == 0) {
+                done = total;
+                return false;
+            }
+            done += processed;
+        }
+        return done < total;
+    }
+
+    int progress() const override {
+        if (total == 0) return 100;
+        return static_cast<int>(min(done, total) * 100 / total);
+    }
+};
+
+// Виконання задачі без виведення прогресу (фонові збереження та завантаження)
+bool runToCompletion(CancellableTask& task) {
+    while (task.step()) {}
+    return true;
+}
+
+// false під час відтворення сесії: задачі виконуються без опитування
+// клавіатури й без індикатора прогресу
+bool interactiveConsole = true;
+
+// Цикл подій для довгих операцій: між кроками задачі зчитує натиснуті
+// клавіші без блокування, показує прогрес і перериває задачу за /cancel.
+// Повертає false, якщо задачу скасовано.
+bool runTask(CancellableTask& task, const string& title) {
+    if (!interactiveConsole) return runToCompletion(task);
+
+    string typed;
+    int shownProgress = -1;
+    bool redraw = false;
+
+    while (task.step()) {
+        while (_kbhit()) {
+            int ch = _getch();
+            if (ch == 0 || ch == 0xE0) {
+                _getch(); // службові клавіші (стрілки тощо) ігноруємо
+                continue;
+            }
+
+            if (ch == '\r' || ch == '\n') {
+                if (isCancelled(typed)) {
+                    cout << endl;
+                    return false;
+                }
+                typed.clear();
+            }
+            else if (ch == '\b') {
+                if (!typed.empty()) typed.pop_back();
+            }
+            else {
+                typed += static_cast<char>(ch);
+            }
+            redraw = true;
+        }
+
+        int current = task.progress();
+        if (current != shownProgress || redraw) {
+            cout << "\r" << title << ": " << setw(3) << current << "%  (/cancel — скасувати) "
+                << typed << "   " << flush;
+            shownProgress = current;
+            redraw = false;
+        }
+    }
+    return true;
+}
+
 
 ////////////////////////////////////
-class MessageStorage {
+enum WordStyle { PLAIN_WORD, BOLD_WORD, ITALIC_WORD };
+
+// Частотний словник для аналітики: відкрита адресація з лінійним пробуванням,
+// ключі зберігаються в арені рядків. Поки різних слів не більше maxWords,
+// частоти точні. Далі словник переходить у наближений режим: лічильники
+// ведуться в count-min sketch, а до таблиці потрапляють лише слова, оцінка
+// яких досягла порогу допуску; коли таблиця переповнюється, поріг
+// подвоюється і рідкісні слова витісняються — пам'ять обмежена незалежно
+// від обсягу переписки.
+class WordFrequency {
 private:
-    set<shared_ptr<Message>, MessageComparator> messages;
-    string filename = "messages.txt";
+    struct Slot {
+        const char* key = nullptr;
+        size_t length = 0;
+        unsigned long long hash = 0;
+        unsigned long long count = 0;
+    };
+
+    static const size_t ARENA_BLOCK = 64 * 1024;
+    static const size_t SKETCH_DEPTH = 4;
+    static const size_t SKETCH_WIDTH = 1 << 16;
+
+    vector<unique_ptr<char[]>> arena;
+    size_t arenaUsed = ARENA_BLOCK;
+    vector<Slot> slots;
+    size_t used = 0;
+
+    bool approximate = false;
+    size_t maxWords;
+    unsigned long long admission = 1;
+    vector<unsigned int> sketch;
+
+    static unsigned long long hashWord(const char* word, size_t length) {
+        unsigned long long h = 14695981039346656037ULL; // FNV-1a
+        for (size_t i = 0; i < length; i++) {
+            h ^= static_cast<unsigned char>(word[i]);
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    const char* storeKey(const char* word, size_t length) {
+        if (length > ARENA_BLOCK) {
+            arena.emplace_back(new char[length]);
+            arenaUsed = ARENA_BLOCK; // наступне слово почне новий блок
+            memcpy(arena.back().get(), word, length);
+            return arena.back().get();
+        }
+        if (arenaUsed + length > ARENA_BLOCK) {
+            arena.emplace_back(new char[ARENA_BLOCK]);
+            arenaUsed = 0;
+        }
+        char* key = arena.back().get() + arenaUsed;
+        memcpy(key, word, length);
+        arenaUsed += length;
+        return key;
+    }
+
+    size_t findSlot(const vector<Slot>& table, unsigned long long h, const char* word, size_t length) const {
+        size_t mask = table.size() - 1;
+        size_t index = static_cast<size_t>(h) & mask;
+        while (table[index].key != nullptr) {
+            const Slot& slot = table[index];
+            if (slot.hash == h && slot.length == length && memcmp(slot.key, word, length) == 0) break;
+            index = (index + 1) & mask;
+        }
+        return index;
+    }
+
+    void rehash(size_t capacity, unsigned long long minCount) {
+        vector<Slot> old;
+        old.swap(slots);
+        slots.assign(capacity, Slot());
+        used = 0;
+
+        // Витіснення переписує ключі в нову арену, щоб звільнити пам'ять рідкісних слів
+        vector<unique_ptr<char[]>> oldArena;
+        if (minCount > 1) {
+            oldArena.swap(arena);
+            arenaUsed = ARENA_BLOCK;
+        }
+
+        for (const Slot& slot : old) {
+            if (slot.key == nullptr || slot.count < minCount) continue;
+            Slot moved = slot;
+            if (minCount > 1) moved.key = storeKey(slot.key, slot.length);
+            slots[findSlot(slots, moved.hash, moved.key, moved.length)] = moved;
+            used++;
+        }
+    }
+
+    unsigned long long sketchAdd(unsigned long long h) {
+        unsigned int estimate = ~0u;
+        unsigned long long h1 = h & 0xFFFFFFFFULL, h2 = h >> 32;
+        for (size_t row = 0; row < SKETCH_DEPTH; row++) {
+            unsigned int& cell = sketch[row * SKETCH_WIDTH + (h1 + row * h2) % SKETCH_WIDTH];
+            if (cell != ~0u) cell++;
+            estimate = min(estimate, cell);
+        }
+        return estimate;
+    }
+
+    // Переносить точні частоти в sketch, щоб оцінки слів не почалися з нуля
+    void switchToSketch() {
+        approximate = true;
+        sketch.assign(SKETCH_DEPTH * SKETCH_WIDTH, 0);
+        for (const Slot& slot : slots) {
+            if (slot.key == nullptr) continue;
+            unsigned long long h1 = slot.hash & 0xFFFFFFFFULL, h2 = slot.hash >> 32;
+            for (size_t row = 0; row < SKETCH_DEPTH; row++) {
+                unsigned int& cell = sketch[row * SKETCH_WIDTH + (h1 + row * h2) % SKETCH_WIDTH];
+                cell = static_cast<unsigned int>(min<unsigned long long>(~0u, cell + slot.count));
+            }
+        }
+    }
 
 public:
-    const set<shared_ptr<Message>, MessageComparator>& getMessages() const {
-        return messages;
+    explicit WordFrequency(size_t maxTrackedWords = 1 << 16)
+        : slots(1024), maxWords(maxTrackedWords) {}
+
+    void add(const char* word, size_t length) {
+        unsigned long long h = hashWord(word, length);
+        unsigned long long count = approximate ? sketchAdd(h) : 1;
+        if (count < admission) return;
+
+        size_t index = findSlot(slots, h, word, length);
+        if (slots[index].key == nullptr) {
+            if ((used + 1) * 10 > slots.size() * 7) {
+                rehash(slots.size() * 2, 1);
+                index = findSlot(slots, h, word, length);
+            }
+            slots[index].key = storeKey(word, length);
+            slots[index].length = length;
+            slots[index].hash = h;
+            slots[index].count = 0;
+            used++;
+        }
+
+        if (approximate) slots[index].count = count;
+        else slots[index].count++;
+
+        if (!approximate && used > maxWords) switchToSketch();
+        while (approximate && used > maxWords) {
+            admission = max<unsigned long long>(2, admission * 2);
+            rehash(slots.size(), admission);
+        }
     }
 
+    bool isApproximate() const {
+        return approximate;
+    }
 
-    void addMessage(shared_ptr<Message> msg) {
-        for (const auto& m : messages) {
-            if (m->getId() == msg->getId()) {
-                cout << "|   Повідомлення з таким ID вже є  |" << endl;
-                cout << "+----------------------------------+" << endl;
-                return;
+    // Top-K через обмежену мін-купу розміру k; результат — за спаданням частоти
+    vector<pair<string, unsigned long long>> top(size_t k) const {
+        typedef pair<unsigned long long, size_t> Entry;
+        priority_queue<Entry, vector<Entry>, greater<Entry>> heap;
+
+        for (size_t i = 0; i < slots.size() && k != 0; i++) {
+            if (slots[i].key == nullptr) continue;
+            if (heap.size() < k) heap.push(Entry(slots[i].count, i));
+            else if (slots[i].count > heap.top().first) {
+                heap.pop();
+                heap.push(Entry(slots[i].count, i));
             }
         }
-        messages.insert(msg);
 
-        // Після додавання оновлюємо глобальний лічильник
-        if (msg->getId() > Message::getGlobalCounter()) {
-            Message::setGlobalCounter(msg->getId());
+        vector<pair<string, unsigned long long>> result;
+        while (!heap.empty()) {
+            const Slot& slot = slots[heap.top().second];
+            result.push_back(make_pair(string(slot.key, slot.length), slot.count));
+            heap.pop();
         }
+        reverse(result.begin(), result.end());
+        return result;
     }
+};
 
+void frameTopWords(const string& title, const WordFrequency& frequency) {
+    screen.line(title);
+    screen.line("+----------------------------------+");
 
-    void displayMessages() const {
-        if (messages.empty()) {
+    vector<pair<string, unsigned long long>> words = frequency.top(5);
+    if (words.empty()) {
+        screen.line("|            Слів немає            |");
+    }
+    for (const auto& entry : words) {
+        screen.line(Row() << "| " << left << setw(24) << entry.first.substr(0, 24) << right
+            << setw(8) << entry.second << " |");
+    }
+    screen.line("+----------------------------------+");
+}
 
-            cout << "|          Чат порожній.           |" << endl;
-            cout << "|      Додайте повідомлення!       |" << endl;
-            cout << "+----------------------------------+" << endl;
-            return;
+// Буферизований запис у файл великими блоками: дрібні записи
+// накопичуються в буфері й потрапляють на диск одним fwrite
+class BufferedWriter {
+private:
+    FILE* file;
+    vector<char> buffer;
+    size_t used = 0;
+    bool failed = false;
+
+public:
+    explicit BufferedWriter(const string& path, size_t capacity = 1 << 20)
+        : file(fopen(path.c_str(), "wb")), buffer(capacity) {}
+
+    BufferedWriter(const BufferedWriter&) = delete;
+    BufferedWriter& operator=(const BufferedWriter&) = delete;
+
+    ~BufferedWriter() {
+        close();
+    }
+
+    bool isOpen() const {
+        return file != nullptr;
+    }
+
+    void put(char ch) {
+        if (used == buffer.size()) flush();
+        buffer[used++] = ch;
+    }
+
+    void write(const char* data, size_t length) {
+        if (length > buffer.size() - used) {
+            flush();
+            // Великі фрагменти пишемо напряму, оминаючи буфер
+            if (length >= buffer.size()) {
+                if (file && fwrite(data, 1, length, file) != length) failed = true;
+                return;
+            }
         }
-        cout << "|           Історія чату           |" << endl;
-        cout << "+----------------------------------+" << endl;
-        for (const auto& msg : messages) {
-            msg->display();
-            cout << "+----------------------------------+" << endl;
+        memcpy(buffer.data() + used, data, length);
+        used += length;
+    }
+
+    void write(const char* text) {
+        write(text, strlen(text));
+    }
+
+    void writeNumber(long long value) {
+        char digits[24];
+        int length = 0;
+        unsigned long long magnitude = value < 0 ? 0ULL - value : value;
+        do {
+            digits[length++] = static_cast<char>('0' + magnitude % 10);
+            magnitude /= 10;
+        } while (magnitude != 0);
+        if (value < 0) put('-');
+        while (length > 0) put(digits[--length]);
+    }
+
+    void flush() {
+        if (used != 0 && file && fwrite(buffer.data(), 1, used, file) != used) failed = true;
+        used = 0;
+    }
+
+    // Повертає false, якщо під час запису сталася помилка
+    bool close() {
+        flush();
+        if (file && fclose(file) != 0) failed = true;
+        file = nullptr;
+        return !failed;
+    }
+};
+
+enum ExportFormat {
+    EXPORT_HISTORY,  // "ID: n|текст" — формат messages.txt
+    EXPORT_JSONL,    // {"id":n,"text":"..."} по одному на рядок, UTF-8
+    EXPORT_CSV,      // id,"текст" з подвоєнням лапок, кодування консолі
+    EXPORT_CSV_UTF8, // те саме в UTF-8 з BOM — для Excel та інших програм
+    EXPORT_RAW       // "#n довжина", далі текст без змін разом з розміткою
+};
+
+// Дописує текст у кодуванні консолі (cp1251) як UTF-8. Перекодування йде
+// порціями через невеликий буфер на стеку; cp1251 однобайтове, тож межа
+// порції чи фрагмента rope ніколи не розрізає символ.
+void writeUtf8(BufferedWriter& out, const char* data, size_t size) {
+    static const int PORTION = 512;
+    wchar_t wide[PORTION];
+    char utf8[PORTION * 3];  // символи cp1251 займають в UTF-8 до 3 байтів
+
+    while (size > 0) {
+        int part = static_cast<int>(min<size_t>(size, PORTION));
+        int wideLength = MultiByteToWideChar(1251, 0, data, part, wide, PORTION);
+        int length = WideCharToMultiByte(CP_UTF8, 0, wide, wideLength, utf8, sizeof(utf8), NULL, NULL);
+        out.write(utf8, static_cast<size_t>(length));
+        data += part;
+        size -= part;
+    }
+}
+
+// Записує одне повідомлення у вибраному форматі. Екранування виконується
+// посимвольно під час запису, без проміжних копій тексту. JSON Lines і
+// CSV (UTF-8) перекодовуються з cp1251 на льоту; решта форматів пишеться
+// в кодуванні консолі, як і messages.txt.
+template <typename Text>
+void writeRecord(BufferedWriter& out, ExportFormat format, int id, const Text& text) {
+    switch (format) {
+    case EXPORT_HISTORY:
+        out.write("ID: ");
+        out.writeNumber(id);
+        out.put('|');
+        forEachChunk(text, [&](const char* data, size_t size) {
+            for (size_t i = 0; i < size; i++) {
+                if (data[i] == '\n') out.write("\\n", 2);
+                else out.put(data[i]);
+            }
+        });
+        out.put('\n');
+        break;
+
+    case EXPORT_JSONL:
+        out.write("{\"id\":");
+        out.writeNumber(id);
+        out.write(",\"text\":\"");
+        forEachChunk(text, [&](const char* data, size_t size) {
+            // Звичайний текст між екранованими символами перекодовується шматком
+            size_t runStart = 0;
+            for (size_t i = 0; i < size; i++) {
+                char ch = data[i];
+                if (ch != '"' && ch != '\\' && static_cast<unsigned char>(ch) >= 0x20) continue;
+
+                writeUtf8(out, data + runStart, i - runStart);
+                runStart = i + 1;
+                switch (ch) {
+                case '"': out.write("\\\"", 2); break;
+                case '\\': out.write("\\\\", 2); break;
+                case '\n': out.write("\\n", 2); break;
+                case '\r': out.write("\\r", 2); break;
+                case '\t': out.write("\\t", 2); break;
+                default: {
+                    const char* hex = "0123456789abcdef";
+                    out.write("\\u00", 4);
+                    out.put(hex[(ch >> 4) & 0xF]);
+                    out.put(hex[ch & 0xF]);
+                }
+                }
+            }
+            writeUtf8(out, data + runStart, size - runStart);
+        });
+        out.write("\"}\n", 3);
+        break;
+
+    case EXPORT_CSV:
+    case EXPORT_CSV_UTF8:
+        out.writeNumber(id);
+        out.write(",\"", 2);
+        forEachChunk(text, [&](const char* data, size_t size) {
+            size_t runStart = 0;
+            for (size_t i = 0; i < size; i++) {
+                if (data[i] != '"') continue;
+                // Лапка лишається в шматку, а перед нею дописується ще одна
+                if (format == EXPORT_CSV_UTF8) writeUtf8(out, data + runStart, i - runStart);
+                else out.write(data + runStart, i - runStart);
+                out.put('"');
+                runStart = i;
+            }
+            if (format == EXPORT_CSV_UTF8) writeUtf8(out, data + runStart, size - runStart);
+            else out.write(data + runStart, size - runStart);
+        });
+        out.write("\"\n", 2);
+        break;
+
+    case EXPORT_RAW:
+        out.put('#');
+        out.writeNumber(id);
+        out.put(' ');
+        out.writeNumber(static_cast<long long>(text.size()));
+        out.put('\n');
+        forEachChunk(text, [&](const char* data, size_t size) { out.write(data, size); });
+        out.put('\n');
+        break;
+    }
+}
+
+
+////////////////////////////////////
+// Зворотна заміна \\n на реальні переноси (messages.txt, трасування сесії)
+void unescapeNewlines(string& text) {
+    size_t pos = 0;
+    while ((pos = text.find("\\n", pos)) != string::npos) {
+        text.replace(pos, 2, "\n");
+        pos += 1;
+    }
+}
+
+// Побайтова копія файлу. Якщо джерела немає, копія видаляється:
+// відсутній файл історії означає порожній чат.
+bool copyHistoryFile(const string& from, const string& to) {
+    ifstream source(from, ios::binary);
+    if (!source.is_open()) {
+        remove(to.c_str());
+        return false;
+    }
+    ofstream target(to, ios::binary | ios::trunc);
+    target << source.rdbuf();
+    return target.good();
+}
+
+enum HistoryLine { LINE_PARSED, LINE_IGNORED, LINE_MALFORMED };
+
+// Розбір рядка messages.txt "ID: n|текст" зі зворотною заміною \\n на
+// переноси. LINE_IGNORED — рядок без роздільників, LINE_MALFORMED — ID не число.
+HistoryLine parseHistoryLine(const string& line, int& id, string& text) {
+    size_t delim = line.find('|');
+    if (delim == string::npos) return LINE_IGNORED;
+
+    size_t colon = line.find(':');
+    if (colon == string::npos || colon > delim) return LINE_IGNORED;
+
+    try {
+        id = stoi(line.substr(colon + 1, delim - colon - 1));
+    }
+    catch (...) {
+        return LINE_MALFORMED;
+    }
+
+    text = line.substr(delim + 1);
+    unescapeNewlines(text);
+    return LINE_PARSED;
+}
+
+enum MergePolicy {
+    MERGE_KEEP_NEWEST,  // з однаковим ID лишається версія з пізнішого джерела
+    MERGE_KEEP_FIRST,   // лишається версія з першого джерела
+    MERGE_RENUMBER      // лишаються всі версії, пізніші отримують нові ID
+};
+
+// Джерело k-way злиття: віддає повідомлення в порядку зростання ID
+class MergeSource {
+public:
+    virtual ~MergeSource() {}
+
+    // Наступне повідомлення; false — джерело вичерпано
+    virtual bool next(shared_ptr<Message>& msg) = 0;
+
+    // Джерело виявилось невпорядкованим — злиття треба повторити
+    virtual bool outOfOrder() const { return false; }
+
+    // Оброблено та всього одиниць (байтів або повідомлень) для прогресу
+    virtual size_t consumed() const = 0;
+    virtual size_t total() const = 0;
+};
+
+// Поточна переписка: знімок уже впорядкований за ID
+class SnapshotSource : public MergeSource {
+private:
+    MessageSnapshot current;
+    MessageSet::const_iterator position;
+    size_t taken = 0;
+
+public:
+    explicit SnapshotSource(const MessageSnapshot& snapshot)
+        : current(snapshot), position(snapshot->begin()) {}
+
+    bool next(shared_ptr<Message>& msg) override {
+        if (position == current->end()) return false;
+        msg = *position++;
+        taken++;
+        return true;
+    }
+
+    size_t consumed() const override { return taken; }
+    size_t total() const override { return current->size(); }
+};
+
+// Файл історії. Відсортований файл читається потоково, по рядку. Якщо ID
+// в ньому йдуть не за зростанням, злиття починається заново, а цей файл
+// тоді читається повністю й сортується в пам'яті (stable_sort зберігає
+// порядок повідомлень з однаковим ID).
+class HistoryFileSource : public MergeSource {
+private:
+    ifstream file;
+    string line;
+    size_t fileSize = 0;
+    size_t bytesRead = 0;
+    int lastId = INT_MIN;
+    bool disordered = false;
+    int malformed = 0;
+
+    bool sortInMemory;
+    vector<shared_ptr<Message>> sorted;
+    size_t cursor = 0;
+
+    bool readRecord(shared_ptr<Message>& msg) {
+        int id;
+        string text;
+        while (getline(file, line)) {
+            bytesRead += line.length() + 1;
+            HistoryLine parsed = parseHistoryLine(line, id, text);
+            if (parsed == LINE_PARSED) {
+                msg = make_shared<SimpleMessage>(text, id);
+                return true;
+            }
+            if (parsed == LINE_MALFORMED) malformed++;
+        }
+        return false;
+    }
+
+public:
+    HistoryFileSource(const string& path, bool sortFirst)
+        : file(path), sortInMemory(sortFirst)
+    {
+        if (!file.is_open()) return;
+
+        file.seekg(0, ios::end);
+        fileSize = static_cast<size_t>(file.tellg());
+        file.seekg(0, ios::beg);
+
+        if (sortInMemory) {
+            shared_ptr<Message> msg;
+            while (readRecord(msg)) sorted.push_back(msg);
+            stable_sort(sorted.begin(), sorted.end(), MessageComparator());
+        }
+    }
+
+    bool isOpen() const { return file.is_open(); }
+    int malformedLines() const { return malformed; }
+
+    bool next(shared_ptr<Message>& msg) override {
+        if (sortInMemory) {
+            if (cursor == sorted.size()) return false;
+            msg = sorted[cursor++];
+            return true;
+        }
+
+        if (!readRecord(msg)) return false;
+        if (msg->getId() < lastId) disordered = true;
+        lastId = msg->getId();
+        return true;
+    }
+
+    bool outOfOrder() const override { return disordered; }
+
+    size_t consumed() const override {
+        if (!sortInMemory) return min(bytesRead, fileSize);
+        return sorted.empty() ? fileSize : fileSize / sorted.size() * cursor;
+    }
+
+    size_t total() const override { return fileSize; }
+};
+
+// k-way злиття за один прохід: купа тримає по одному поточному повідомленню
+// з кожного джерела й щоразу віддає найменший ID (за рівних — з раннішого
+// джерела). Групу з однаковим ID вирішує політика; однакові тексти — не
+// конфлікт, а дублікат. Результат виходить уже впорядкованим, тож дерево
+// з нього будується без вставок по одному.
+class KWayMerge : public CancellableTask {
+private:
+    struct Head {
+        shared_ptr<Message> msg;
+        size_t source;
+    };
+
+    struct Later {
+        bool operator()(const Head& a, const Head& b) const {
+            if (a.msg->getId() != b.msg->getId()) return a.msg->getId() > b.msg->getId();
+            return a.source > b.source;
+        }
+    };
+
+    static const int BATCH = 1024;
+
+    vector<shared_ptr<MergeSource>> sources;
+    MergePolicy policy;
+    priority_queue<Head, vector<Head>, Later> heap;
+    vector<Head> group;
+    bool stopped = false;
+
+    vector<shared_ptr<Message>> merged;
+    vector<shared_ptr<Message>> losers;
+    int duplicates = 0;
+    int conflicts = 0;
+    int imported = 0;
+
+    static bool sameText(const Message& a, const Message& b) {
+        shared_ptr<const TextRope> left = a.scanBody();
+        shared_ptr<const TextRope> right = b.scanBody();
+        return left->size() == right->size() && left->str() == right->str();
+    }
+
+    // Бере з джерела наступне повідомлення; false — джерело невпорядковане
+    bool advance(size_t source) {
+        shared_ptr<Message> msg;
+        if (!sources[source]->next(msg)) return true;
+        if (sources[source]->outOfOrder()) return false;
+        heap.push(Head{ msg, source });
+        return true;
+    }
+
+    void resolve() {
+        vector<const Head*> distinct;
+        for (const Head& candidate : group) {
+            bool same = false;
+            for (const Head* kept : distinct) {
+                if (sameText(*kept->msg, *candidate.msg)) {
+                    same = true;
+                    break;
+                }
+            }
+            if (same) duplicates++;
+            else distinct.push_back(&candidate);
+        }
+        conflicts += static_cast<int>(distinct.size()) - 1;
+
+        const Head& winner = policy == MERGE_KEEP_NEWEST ? *distinct.back() : *distinct.front();
+        if (winner.source != 0) imported++;
+        merged.push_back(winner.msg);
+
+        if (policy == MERGE_RENUMBER) {
+            for (size_t i = 1; i < distinct.size(); i++) losers.push_back(distinct[i]->msg);
+        }
+    }
+
+public:
+    KWayMerge(const vector<shared_ptr<MergeSource>>& mergeSources, MergePolicy mergePolicy)
+        : sources(mergeSources), policy(mergePolicy)
+    {
+        for (size_t i = 0; i < sources.size() && !stopped; i++) {
+            stopped = !advance(i);
+        }
+    }
+
+    bool step() override {
+        for (int i = 0; i < BATCH; i++) {
+            if (stopped || heap.empty()) return false;
+
+            int id = heap.top().msg->getId();
+            group.clear();
+            while (!heap.empty() && heap.top().msg->getId() == id) {
+                Head head = heap.top();
+                heap.pop();
+                group.push_back(head);
+                if (!advance(head.source)) {
+                    stopped = true;
+                    return false;
+                }
+            }
+            resolve();
+        }
+        return !stopped && !heap.empty();
+    }
+
+    int progress() const override {
+        size_t done = 0, all = 0;
+        for (const auto& source : sources) {
+            done += source->consumed();
+            all += source->total();
+        }
+        return all == 0 ? 100 : static_cast<int>(done * 100 / all);
+    }
+
+    // Злиття перервано невпорядкованим джерелом
+    bool interrupted() const { return stopped; }
+
+    vector<shared_ptr<Message>>& result() { return merged; }
+    const vector<shared_ptr<Message>>& renumbered() const { return losers; }
+    int duplicateCount() const { return duplicates; }
+    int conflictCount() const { return conflicts; }
+    int importedCount() const { return imported; }
+};
+
+// Підсумок злиття для показу користувачу
+struct MergeReport {
+    string missingFile;
+    int imported = 0;
+    int duplicates = 0;
+    int conflicts = 0;
+    int renumbered = 0;
+    int sortedInMemory = 0;
+    int malformed = 0;
+};
+
+
+////////////////////////////////////
+enum ChangeType {
+    CHANGE_ADDED,
+    CHANGE_EDITED,
+    CHANGE_DELETED,
+    CHANGE_CLEARED,
+    CHANGE_RELOADED,  // вміст замінено цілком (завантаження, злиття, архів)
+    CHANGE_OVERRUN    // підписник відстав і втратив події
+};
+
+// Після CHANGE_RELOADED і CHANGE_OVERRUN підписник перечитує snapshot()
+struct ChangeEvent {
+    unsigned long long sequence;
+    ChangeType type;
+    int id;                      // 0 для подій без конкретного повідомлення
+    unsigned long long version;  // версія повідомлення для ADDED та EDITED
+};
+
+// Стрічка змін сховища: кільцевий буфер слотів фіксованого розміру.
+// Писач один — події публікуються під writeMutex, — тож запис події це
+// кілька атомарних збережень без блокувань і виділення пам'яті. Слот
+// працює як seqlock: номер події записується останнім, і читач, який
+// після читання полів бачить інший номер, знає, що слот перезаписано.
+// Замість окремих бар'єрів поля пишуться з release і читаються з acquire:
+// читач, що побачив хоч одне нове поле, побачить і обнулений номер.
+class ChangeFeed {
+public:
+    static const unsigned long long CAPACITY = 1024;  // степінь двійки
+
+private:
+    struct Slot {
+        atomic<unsigned long long> sequence{0};
+        atomic<int> type{0};
+        atomic<int> id{0};
+        atomic<unsigned long long> version{0};
+    };
+
+    Slot slots[CAPACITY];
+    atomic<unsigned long long> head{0};  // номер останньої опублікованої події
+
+public:
+    void emit(ChangeType type, int id = 0, unsigned long long version = 0) {
+        unsigned long long sequence = head.load(memory_order_relaxed) + 1;
+        Slot& slot = slots[sequence & (CAPACITY - 1)];
+
+        slot.sequence.store(0, memory_order_relaxed);
+        slot.type.store(type, memory_order_release);
+        slot.id.store(id, memory_order_release);
+        slot.version.store(version, memory_order_release);
+        slot.sequence.store(sequence, memory_order_release);
+        head.store(sequence, memory_order_release);
+    }
+
+    unsigned long long last() const {
+        return head.load(memory_order_acquire);
+    }
+
+    // Читає подію з номером sequence; false — слот уже перезаписано
+    bool read(unsigned long long sequence, ChangeEvent& event) const {
+        const Slot& slot = slots[sequence & (CAPACITY - 1)];
+        if (slot.sequence.load(memory_order_acquire) != sequence) return false;
+
+        event.sequence = sequence;
+        event.type = static_cast<ChangeType>(slot.type.load(memory_order_acquire));
+        event.id = slot.id.load(memory_order_acquire);
+        event.version = slot.version.load(memory_order_acquire);
+
+        return slot.sequence.load(memory_order_relaxed) == sequence;
+    }
+};
+
+// Підписка на стрічку змін з власним курсором. poll() віддає пакетом
+// події, що накопичились з попереднього виклику; писач про підписників
+// не знає й не чекає на них. Якщо підписник відстав більше ніж на ємність
+// буфера, пакет закінчується подією CHANGE_OVERRUN, а курсор переходить
+// на останню подію.
+class ChangeSubscription {
+private:
+    shared_ptr<const ChangeFeed> feed;
+    unsigned long long cursor;
+
+public:
+    explicit ChangeSubscription(const shared_ptr<const ChangeFeed>& source)
+        : feed(source), cursor(source->last()) {}
+
+    size_t poll(vector<ChangeEvent>& batch, size_t maxEvents = 256) {
+        batch.clear();
+        unsigned long long last = feed->last();
+
+        while (cursor < last && batch.size() < maxEvents) {
+            ChangeEvent event;
+            if (last - cursor > ChangeFeed::CAPACITY || !feed->read(cursor + 1, event)) {
+                cursor = feed->last();
+                event.sequence = cursor;
+                event.type = CHANGE_OVERRUN;
+                event.id = 0;
+                event.version = 0;
+                batch.push_back(event);
+                break;
+            }
+            batch.push_back(event);
+            cursor++;
+        }
+        return batch.size();
+    }
+
+    // Номер останньої отриманої події
+    unsigned long long position() const {
+        return cursor;
+    }
+};
+
+class MessageStorage {
+private:
+    // RCU-публікація переписки: читачі (показ, пошук, статистика, збереження)
+    // беруть знімок через RcuPointer і ніколи не чекають на записи. Писачі
+    // по черзі (writeMutex) будують нову версію з копіюванням шляху в дереві
+    // й публікують її. Стара версія звільняється, щойно її відпустить
+    // останній читач. Режим архіву перемикається лише з потоку інтерфейсу.
+    RcuPointer<const MessageSet> messages{ make_shared<const MessageSet>() };
+    mutex writeMutex;
+    string filename = "messages.txt";
+    shared_ptr<MappedHistory> archive;
+
+    // Бюджет пам'яті на тіла повідомлень: понад нього найдавніше використані
+    // тіла витісняються у файл кешу поруч з файлом історії. Кеш разом з
+    // обліком резидентних байтів замінюється, коли замінюється вміст чату.
+    static const size_t MEMORY_BUDGET = 64 * 1024 * 1024;
+    RcuPointer<BodyCache> cache;
+    mutable mutex spillMutex;
+
+    // Кеш відображення: готові байти виводу кожного повідомлення (текст з
+    // ESC-послідовностями). Запис дійсний лише для тієї версії повідомлення,
+    // з якої його зібрано, тож повторний перегляд незмінної історії — це
+    // просто копіювання байтів у консоль. Дуже довгі повідомлення не
+    // кешуються, а при перевищенні бюджету витісняються інші записи.
+    struct RenderEntry {
+        unsigned long long version;
+        shared_ptr<const string> bytes;
+    };
+    static const size_t RENDER_CACHE_BUDGET = 16 * 1024 * 1024;
+    mutable unordered_map<int, RenderEntry> renderCache;
+    mutable size_t renderBytes = 0;
+    mutable mutex renderMutex;
+
+    atomic<bool> dirty{false};
+
+    // Стрічка змін для дзеркал переписки (індекси, експорт, репліки)
+    shared_ptr<ChangeFeed> changes = make_shared<ChangeFeed>();
+
+    enum HistoryResult { HISTORY_OK, HISTORY_NOT_FOUND, HISTORY_CANCELLED, HISTORY_FAILED };
+
+    // Орієнтовні накладні витрати на повідомлення понад текст: сам об'єкт,
+    // вузол дерева та блоки керування shared_ptr. Витісненням їх не
+    // звільнити, тож до бюджету тіл вони не входять — лише до memoryUsage().
+    static const size_t MESSAGE_OVERHEAD = sizeof(SimpleMessage) + 96;
+
+    // Викликається лише під writeMutex
+    void publish(MessageSnapshot next) {
+        messages.store(next);
+    }
+
+    shared_ptr<BodyCache> newCache() const {
+        static atomic<unsigned> serial(0);
+        return make_shared<BodyCache>(filename + "." + to_string(++serial) + ".spill");
+    }
+
+    shared_ptr<BodyCache> currentCache() const {
+        return cache.load();
+    }
+
+    // Порожня переписка з новим кешем; викликається лише під writeMutex.
+    // Старий файл кешу видаляється, коли зникнуть останні знімки зі старими
+    // повідомленнями.
+    void resetContents() {
+        publish(make_shared<const MessageSet>());
+        cache.store(newCache());
+        clearRenderCache();
+    }
+
+    // Готові байти повідомлення з кешу рендерингу. Для тіл, завеликих для
+    // кешу, повертає nullptr: такі повідомлення виводяться потоком через
+    // display(), без суцільного рядка.
+    shared_ptr<const string> rendered(const shared_ptr<Message>& msg) const {
+        {
+            lock_guard<mutex> guard(renderMutex);
+            auto found = renderCache.find(msg->getId());
+            if (found != renderCache.end() && found->second.version == msg->getVersion()) {
+                return found->second.bytes;
+            }
+        }
+
+        if (msg->getBody()->size() > RENDER_CACHE_BUDGET / 16) return nullptr;
+        shared_ptr<const string> bytes = make_shared<const string>(msg->render());
+        if (bytes->size() > RENDER_CACHE_BUDGET / 16) return bytes;
+
+        lock_guard<mutex> guard(renderMutex);
+        RenderEntry& entry = renderCache[msg->getId()];
+        if (entry.bytes) renderBytes -= entry.bytes->size();
+        entry.version = msg->getVersion();
+        entry.bytes = bytes;
+        renderBytes += bytes->size();
+
+        for (auto it = renderCache.begin(); renderBytes > RENDER_CACHE_BUDGET && it != renderCache.end();) {
+            if (it->first == msg->getId()) {
+                ++it;
+                continue;
+            }
+            renderBytes -= it->second.bytes->size();
+            it = renderCache.erase(it);
+        }
+        return bytes;
+    }
+
+    void invalidateRender(int id) const {
+        lock_guard<mutex> guard(renderMutex);
+        auto found = renderCache.find(id);
+        if (found == renderCache.end()) return;
+        renderBytes -= found->second.bytes->size();
+        renderCache.erase(found);
+    }
+
+    void clearRenderCache() const {
+        lock_guard<mutex> guard(renderMutex);
+        renderCache.clear();
+        renderBytes = 0;
+    }
+
+    // Спільна частина addMessages і readHistory. replace — завантаження з
+    // файлу: переписка очищується в тій самій критичній секції, а
+    // підписники отримують одну подію CHANGE_RELOADED замість події на
+    // кожне повідомлення. Так само й пакет, більший за ємність стрічки:
+    // інакше він витіснив би з буфера власні події і кожен підписник
+    // отримав би CHANGE_OVERRUN.
+    int insertBatch(vector<shared_ptr<Message>>& incoming, bool replace) {
+        stable_sort(incoming.begin(), incoming.end(), MessageComparator());
+
+        lock_guard<mutex> guard(writeMutex);
+        if (replace) resetContents();
+        MessageSnapshot current = snapshot();
+        shared_ptr<const MessageSet> next;
+
+        vector<shared_ptr<Message>> fresh;
+        shared_ptr<BodyCache> bodies = currentCache();
+        auto accept = [&](const shared_ptr<Message>& msg) {
+            msg->attach(bodies);
+            fresh.push_back(msg);
+        };
+
+        if (incoming.size() * 32 < current->size()) {
+            // Невеликий пакет у великій переписці: вставки з копіюванням
+            // шляху дешевші за перебудову всього дерева
+            MessageSet grown = *current;
+            for (const auto& msg : incoming) {
+                bool duplicate = grown.count(msg->getId()) != 0;
+                if (duplicate) continue;
+                accept(msg);
+                grown = grown.with(msg);
+            }
+            next = make_shared<const MessageSet>(grown);
+        }
+        else {
+            vector<shared_ptr<Message>> merged;
+            merged.reserve(current->size() + incoming.size());
+            auto existing = current->begin();
+            for (const auto& msg : incoming) {
+                while (existing != current->end() && (*existing)->getId() < msg->getId()) {
+                    merged.push_back(*existing++);
+                }
+
+                bool duplicate = (existing != current->end() && (*existing)->getId() == msg->getId())
+                    || (!merged.empty() && merged.back()->getId() == msg->getId());
+                if (duplicate) continue;
+
+                accept(msg);
+                merged.push_back(msg);
+            }
+            for (; existing != current->end(); ++existing) merged.push_back(*existing);
+            next = make_shared<const MessageSet>(merged.begin(), merged.end());
+        }
+
+        if (!fresh.empty()) {
+            publish(next);
+            dirty = true;
+
+            // Лічильник оновлюємо один раз — максимальний ID стоїть останнім
+            Message::raiseGlobalCounter(next->back()->getId());
+        }
+
+        // Події — лише після публікації, щоб підписник, який перечитує
+        // знімок, уже бачив зміни
+        if (replace || fresh.size() > ChangeFeed::CAPACITY) {
+            changes->emit(CHANGE_RELOADED);
+        }
+        else {
+            for (const auto& msg : fresh) changes->emit(CHANGE_ADDED, msg->getId(), msg->getVersion());
+        }
+
+        if (!fresh.empty()) enforceBudget();
+        return static_cast<int>(fresh.size());
+    }
+
+    // Витісняє на диск тіла найдавніше використаних повідомлень, коли
+    // перевищено бюджет. Звільняє із запасом, до 3/4 бюджету, щоб не
+    // перебирати переписку після кожного підвантаження. Бюджет стосується
+    // лише тіл, тож коли витісняти нічого, перевірка коштує O(1); так само
+    // й після збою запису файлу кешу.
+    void enforceBudget() const {
+        shared_ptr<BodyCache> bodies = currentCache();
+        if (bodies->spillableBytes <= MEMORY_BUDGET || bodies->failed) return;
+
+        unique_lock<mutex> guard(spillMutex, try_to_lock);
+        if (!guard.owns_lock()) return; // вже витісняє інший потік
+
+        MessageSnapshot current = snapshot();
+        vector<pair<unsigned long long, Message*>> candidates;
+        candidates.reserve(current->size());
+        for (const auto& msg : *current) {
+            if (msg->residentBodyBytes() != 0) {
+                candidates.push_back(make_pair(msg->getLastAccess(), msg.get()));
+            }
+        }
+        sort(candidates.begin(), candidates.end());
+
+        size_t target = MEMORY_BUDGET / 4 * 3;
+        for (const auto& candidate : candidates) {
+            if (bodies->spillableBytes <= target) break;
+            candidate.second->spill();
+        }
+        bodies->reclaim();
+    }
+
+    // Запис історії у тимчасовий файл з атомарною заміною основного.
+    // interactive — з прогресом і можливістю скасування через /cancel.
+    HistoryResult writeHistory(bool interactive) {
+        string tempName = filename + ".tmp";
+        BufferedWriter file(tempName);
+        if (!file.isOpen()) return HISTORY_FAILED;
+
+        MessageSnapshot current = snapshot();
+        auto it = current->begin();
+        ChunkedTask task(current->size(), [&]() -> size_t {
+            const auto& msg = *it++;
+            writeRecord(file, EXPORT_HISTORY, msg->getId(), *msg->scanBody());
+            return 1;
+        });
+
+        bool completed = interactive ? runTask(task, "Збереження") : runToCompletion(task);
+        bool written = file.close();
+
+        if (!completed) {
+            remove(tempName.c_str());
+            return HISTORY_CANCELLED;
+        }
+
+        if (!written || !MoveFileExA(tempName.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+            remove(tempName.c_str());
+            return HISTORY_FAILED;
+        }
+
+        // Зміни, опубліковані під час запису, лишаються незбереженими
+        lock_guard<mutex> guard(writeMutex);
+        if (snapshot() == current) dirty = false;
+        return HISTORY_OK;
+    }
+
+    // Читання історії з файлу; поточна переписка замінюється лише після
+    // повного читання, тож скасування залишає її без змін
+    HistoryResult readHistory(bool interactive, int& loadedCount) {
+        ifstream file(filename);
+        if (!file.is_open()) return HISTORY_NOT_FOUND;
+
+        // Прогрес рахується в байтах прочитаного файлу
+        file.seekg(0, ios::end);
+        size_t fileSize = static_cast<size_t>(file.tellg());
+        file.seekg(0, ios::beg);
+
+        string line;
+        vector<shared_ptr<Message>> loaded;
+        int counterBefore = Message::getGlobalCounter();
+
+        ChunkedTask task(fileSize, [&]() -> size_t {
+            if (!getline(file, line)) return 0;
+
+            int id;
+            string text;
+            HistoryLine parsed = parseHistoryLine(line, id, text);
+            if (parsed == LINE_PARSED) {
+                loaded.push_back(make_shared<SimpleMessage>(text, id));
+            }
+            else if (parsed == LINE_MALFORMED) {
+                cout << "Пропущено некоректний рядок: " << line << endl;
+                screen.invalidate();
+            }
+            return line.length() + 1;
+        });
+
+        bool completed = interactive ? runTask(task, "Завантаження") : runToCompletion(task);
+        if (!completed) {
+            Message::setGlobalCounter(counterBefore);
+            return HISTORY_CANCELLED;
+        }
+
+        closeArchive();
+        loadedCount = insertBatch(loaded, true);
+        dirty = false;
+        return HISTORY_OK;
+    }
+
+    // Зливає поточну переписку (джерело 0) з файлами історії в порядку
+    // переліку. Увесь прохід іде під writeMutex, тож правки між читанням
+    // знімка та публікацією неможливі; читачі тим часом бачать стару версію.
+    HistoryResult mergeHistories(const vector<string>& paths, MergePolicy policy,
+        bool interactive, MergeReport& report)
+    {
+        lock_guard<mutex> guard(writeMutex);
+        MessageSnapshot current = snapshot();
+        int counterBefore = Message::getGlobalCounter();
+        vector<bool> sortInMemory(paths.size(), false);
+
+        while (true) {
+            vector<shared_ptr<MergeSource>> sources;
+            vector<shared_ptr<HistoryFileSource>> files;
+            sources.push_back(make_shared<SnapshotSource>(current));
+            for (size_t i = 0; i < paths.size(); i++) {
+                shared_ptr<HistoryFileSource> file = make_shared<HistoryFileSource>(paths[i], sortInMemory[i]);
+                if (!file->isOpen()) {
+                    Message::setGlobalCounter(counterBefore);
+                    report.missingFile = paths[i];
+                    return HISTORY_NOT_FOUND;
+                }
+                files.push_back(file);
+                sources.push_back(file);
+            }
+
+            KWayMerge task(sources, policy);
+            bool completed = interactive ? runTask(task, "Злиття") : runToCompletion(task);
+            if (!completed) {
+                Message::setGlobalCounter(counterBefore);
+                return HISTORY_CANCELLED;
+            }
+
+            // Невпорядкований файл: повтор, цей файл буде відсортовано в пам'яті
+            if (task.interrupted()) {
+                for (size_t i = 0; i < files.size(); i++) {
+                    if (files[i]->outOfOrder()) sortInMemory[i] = true;
+                }
+                Message::setGlobalCounter(counterBefore);
+                continue;
+            }
+
+            vector<shared_ptr<Message>>& merged = task.result();
+            // Нові ID видає лічильник, вже піднятий до найбільшого ID злиття,
+            // тож перенумеровані повідомлення стають у кінець без сортування
+            for (const auto& loser : task.renumbered()) {
+                merged.push_back(make_shared<SimpleMessage>(*loser->scanBody()));
+            }
+
+            report.imported = task.importedCount() + static_cast<int>(task.renumbered().size());
+            report.duplicates = task.duplicateCount();
+            report.conflicts = task.conflictCount();
+            report.renumbered = static_cast<int>(task.renumbered().size());
+            report.sortedInMemory = static_cast<int>(count(sortInMemory.begin(), sortInMemory.end(), true));
+            for (const auto& file : files) report.malformed += file->malformedLines();
+
+            if (report.imported == 0) return HISTORY_OK;
+
+            shared_ptr<BodyCache> bodies = currentCache();
+            unordered_set<const Message*> kept;
+            for (const auto& msg : merged) {
+                msg->attach(bodies);
+                kept.insert(msg.get());
+            }
+            for (const auto& msg : *current) {
+                if (kept.count(msg.get()) == 0) msg->detach();
+            }
+
+            publish(make_shared<const MessageSet>(merged.begin(), merged.end()));
+            changes->emit(CHANGE_RELOADED);
+            dirty = true;
+            enforceBudget();
+            return HISTORY_OK;
+        }
+    }
+
+    // Розбиття тексту на слова за правилами розмітки *жирний* / _курсив_.
+    // onWord отримує вказівник і довжину без копіювання; лише слово, що
+    // перетинає межу фрагментів rope, склеюється в невеликий буфер.
+    template <typename Text, typename Callback>
+    static void tokenize(const Text& txt, Callback onWord) {
+        bool inBold = false, inItalic = false;
+        char previous = 0;
+        const char* wordStart = nullptr;
+        size_t wordLength = 0;
+        string carried;  // початок слова з попереднього фрагмента
+
+        auto flush = [&]() {
+            WordStyle style = inBold ? BOLD_WORD : (inItalic ? ITALIC_WORD : PLAIN_WORD);
+            if (!carried.empty()) {
+                carried.append(wordStart ? wordStart : "", wordLength);
+                onWord(carried.data(), carried.size(), style);
+                carried.clear();
+            }
+            else if (wordLength != 0) {
+                onWord(wordStart, wordLength, style);
+            }
+            wordStart = nullptr;
+            wordLength = 0;
+        };
+
+        forEachChunk(txt, [&](const char* data, size_t size) {
+            for (size_t i = 0; i < size; ++i) {
+                char ch = data[i];
+                bool escaped = previous == '\\';
+                previous = ch;
+
+                if (ch == '*' && !escaped) {
+                    flush();
+                    inBold = !inBold;
+                    continue;
+                }
+
+                if (ch == '_' && !escaped) {
+                    flush();
+                    inItalic = !inItalic;
+                    continue;
+                }
+
+                if (isspace((unsigned char)ch) || ispunct((unsigned char)ch)) {
+                    flush();
+                }
+                else {
+                    if (wordLength == 0) wordStart = data + i;
+                    wordLength++;
+                }
+            }
+
+            // Незавершене слово переноситься в наступний фрагмент
+            if (wordLength != 0) {
+                carried.append(wordStart, wordLength);
+                wordStart = nullptr;
+                wordLength = 0;
+            }
+        });
+        flush(); // останнє слово
+    }
+
+public:
+    MessageStorage()
+        : cache(newCache()) {}
+
+    explicit MessageStorage(const string& file)
+        : filename(file), cache(newCache()) {}
+
+    // Узгоджений знімок переписки без блокувань; поки знімок утримується,
+    // його вміст не змінюється, навіть якщо паралельно публікуються нові версії
+    MessageSnapshot snapshot() const {
+        return messages.load();
+    }
+
+    // Підписка на зміни з поточного моменту. Дзеркало спершу підписується,
+    // потім бере snapshot() і далі застосовує події пакетами з poll();
+    // подія, що вже потрапила в знімок, може прийти повторно
+    ChangeSubscription subscribe() const {
+        return ChangeSubscription(changes);
+    }
+
+    const string& getFilename() const {
+        return filename;
+    }
+
+    bool hasUnsavedChanges() const {
+        return dirty;
+    }
+
+    // Орієнтовний обсяг пам'яті, який займає переписка (для кешу чатів)
+    size_t memoryUsage() const {
+        size_t rendered;
+        {
+            lock_guard<mutex> guard(renderMutex);
+            rendered = renderBytes;
+        }
+        size_t overhead = snapshot()->size() * MESSAGE_OVERHEAD;
+        return overhead + currentCache()->residentBytes + rendered + (archive ? archive->indexBytes() : 0);
+    }
+
+    // Тихе відкриття для менеджера чатів; відсутній файл означає новий чат
+    bool open() {
+        int loadedCount = 0;
+        return readHistory(false, loadedCount) != HISTORY_CANCELLED;
+    }
+
+    // Тихе збереження незбережених змін (при витісненні чату з кешу)
+    bool flush() {
+        if (!dirty || archive) return true;
+        return writeHistory(false) == HISTORY_OK;
+    }
+
+    // Лічильник ID спільний для всіх повідомлень, тож при переході до чату
+    // він піднімається щонайменше до найбільшого ID цього чату. Знижувати
+    // його не можна: ID видалених повідомлень видалися б повторно
+    void activate() const {
+        MessageSnapshot current = snapshot();
+        if (!current->empty()) Message::raiseGlobalCounter(current->back()->getId());
+    }
+
+    bool isArchiveMode() const {
+        return archive != nullptr;
+    }
+
+    // Відкриває файл історії лише для перегляду, пошуку та статистики
+    // Архів показує файл, а переписка з пам'яті при цьому скидається, тож
+    // незбережені зміни спершу зберігаються (за згодою користувача).
+    // Повертає, чи відкрито архів.
+    bool openArchive() {
+        if (hasUnsavedChanges()) {
+            bool save = true;
+            if (interactiveConsole) {
+                screen.begin();
+                screen.line("|   У переписці є незбережені      |");
+                screen.line("|   зміни. Зберегти їх і відкрити  |");
+                screen.line("|   архів?                         |");
+                screen.line("+----------------------------------+");
+                screen.present();
+
+                string answer;
+                cout << "(Y/N): ";
+                getline(cin, answer);
+                save = answer == "Y" || answer == "y";
+            }
+
+            if (!save || !flush()) {
+                screen.begin();
+                if (save) screen.line("|  Не вдалося зберегти переписку!  |");
+                else screen.line("|   Відкриття архіву скасовано     |");
+                screen.line("+----------------------------------+");
+                screen.present();
+                return false;
+            }
+        }
+
+        shared_ptr<MappedHistory> mapped = make_shared<MappedHistory>();
+        screen.begin();
+
+        if (!mapped->open(filename)) {
+            screen.line("|         Файл не знайдено!        |");
+            screen.line("+----------------------------------+");
+            screen.present();
+            return false;
+        }
+
+        {
+            lock_guard<mutex> guard(writeMutex);
+            // Зміни, що з'явилися після збереження, не скидаємо мовчки
+            if (dirty) {
+                screen.line("|   Переписку щойно змінено, архів |");
+                screen.line("|   не відкрито                    |");
+                screen.line("+----------------------------------+");
+                screen.present();
+                return false;
+            }
+            resetContents();
+            changes->emit(CHANGE_RELOADED);
+        }
+        archive = mapped;
+        screen.line("|  Архів відкрито лише для читання |");
+        screen.line(Row() << "|   Повідомлень в архіві: " << setw(9) << archive->count() << " |");
+        screen.line("+----------------------------------+");
+        screen.present();
+        return true;
+    }
+
+    void closeArchive() {
+        archive.reset();
+    }
+
+
+    // Одиночне додавання копіює лише шлях у дереві (O(log n)); великі
+    // пакети швидше подавати разом через addMessages
+    void addMessage(shared_ptr<Message> msg) {
+        {
+            lock_guard<mutex> guard(writeMutex);
+            MessageSnapshot current = snapshot();
+            if (current->count(msg->getId()) == 0) {
+                shared_ptr<BodyCache> bodies = currentCache();
+                msg->attach(bodies);
+                publish(make_shared<const MessageSet>(current->with(msg)));
+                changes->emit(CHANGE_ADDED, msg->getId(), msg->getVersion());
+                dirty = true;
+
+                // Після додавання оновлюємо глобальний лічильник
+                Message::raiseGlobalCounter(msg->getId());
+                enforceBudget();
+                return;
+            }
+        }
+        cout << "|   Повідомлення з таким ID вже є  |" << endl;
+        cout << "+----------------------------------+" << endl;
+        screen.invalidate();
+    }
+
+    // Пакетне додавання (імпорт, реплікація): пакет сортується один раз і
+    // зливається з наявними ID за один прохід, дублікати відкидаються,
+    // а дерево будується з уже відсортованого діапазону за лінійний час.
+    // Повертає кількість доданих повідомлень.
+    template <typename Range>
+    int addMessages(const Range& batch) {
+        vector<shared_ptr<Message>> incoming(begin(batch), end(batch));
+        return insertBatch(incoming, false);
+    }
+
+
+    void displayMessages() const {
+        if (archive) {
+            displayArchive();
+            return;
+        }
+
+        MessageSnapshot current = snapshot();
+        screen.begin();
+        if (current->empty()) {
+
+            screen.line("|          Чат порожній.           |");
+            screen.line("|      Додайте повідомлення!       |");
+            screen.line("+----------------------------------+");
+            screen.present();
+            return;
+        }
+        screen.line("|           Історія чату           |");
+        screen.line("+----------------------------------+");
+        screen.present();
+
+        // Кольорова історія виводиться під кадром і може прокрутити екран
+        for (const auto& msg : *current) {
+            shared_ptr<const string> bytes = rendered(msg);
+            if (bytes) cout.write(bytes->data(), bytes->size());
+            else msg->display();
+            cout << "+----------------------------------+" << endl;
+        }
+        screen.invalidate();
+        enforceBudget();
+    }
+
+    void displayArchive() const {
+        screen.begin();
+        if (archive->count() == 0) {
+            screen.line("|          Архів порожній.         |");
+            screen.line("+----------------------------------+");
+            screen.present();
+            return;
+        }
+        screen.line("|     Історія чату (з архіву)      |");
+        screen.line("+----------------------------------+");
+        screen.present();
+
+        for (size_t i = 0; i < archive->count(); i++) {
+            setConsoleColor(8);
+            cout << "ID: " << archive->idAt(i) << " - ";
+            applyFormatting(archive->textView(i));
+            setConsoleColor(8);
+            cout << "+----------------------------------+" << endl;
+        }
+        screen.invalidate();
+    }
+
+    bool editMessageById(int idToEdit, const TextRope& newText) {
+        shared_ptr<Message> editedMsg = make_shared<SimpleMessage>(newText, idToEdit);
+
+        lock_guard<mutex> guard(writeMutex);
+        MessageSnapshot current = snapshot();
+        auto found = current->find(idToEdit);
+        if (found == current->end()) return false;
+
+        shared_ptr<BodyCache> bodies = currentCache();
+        editedMsg->attach(bodies);
+        (*found)->detach();
+        publish(make_shared<const MessageSet>(current->with(editedMsg)));
+        changes->emit(CHANGE_EDITED, idToEdit, editedMsg->getVersion());
+        invalidateRender(idToEdit);
+        dirty = true;
+        enforceBudget();
+        return true;
+    }
+
+    void deleteMessageById(int idToDelete) {
+        bool found = false;
+        {
+            lock_guard<mutex> guard(writeMutex);
+            MessageSnapshot current = snapshot();
+            auto it = current->find(idToDelete);
+            if (it != current->end()) {
+                (*it)->detach();
+                publish(make_shared<const MessageSet>(current->without(idToDelete)));
+                changes->emit(CHANGE_DELETED, idToDelete);
+                invalidateRender(idToDelete);
+                dirty = true;
+                found = true;
+            }
+        }
+
+        screen.begin();
+        if (found) {
+            screen.line("|   Повідомлення видалено успішно  |");
+        }
+        else {
+            screen.line("|   Повідомлення з таким ID нема   |");
+        }
+        screen.line("+----------------------------------+");
+        screen.present();
+    }
+
+
+    void showStatistics() const {
+        // Лічильники 64-бітні: на багатогігабайтних історіях int переповнився б
+        unsigned long long totalMessages = 0;
+        unsigned long long totalWords = 0, totalChars = 0;
+        unsigned long long boldWords = 0, italicWords = 0;
+
+        // Дедуплікація: скільки байтів займали б тексти без спільного сховища.
+        // Частку кожного спільного фрагмента рахуємо через лічильник посилань,
+        // щоб не тримати множину всіх текстів.
+        double logicalBytes = 0, uniqueBytes = 0, uniqueTexts = 0;
+
+        // Коли різних слів стає забагато, частоти рахуються наближено в обмеженій пам'яті
+        MessageSnapshot current = snapshot();
+        WordFrequency topAll, topBold, topItalic;
+
+        auto account = [&](const auto& txt) {
+            totalMessages++;
+            totalChars += txt.size();
+            tokenize(txt, [&](const char* word, size_t length, WordStyle style) {
+                if (style == BOLD_WORD) {
+                    boldWords++;
+                    topBold.add(word, length);
+                }
+                else if (style == ITALIC_WORD) {
+                    italicWords++;
+                    topItalic.add(word, length);
+                }
+                else {
+                    totalWords++;
+                }
+                topAll.add(word, length);
+            });
+        };
+
+        bool completed;
+        if (archive) {
+            size_t index = 0;
+            ChunkedTask task(archive->count(), [&]() -> size_t {
+                account(archive->textView(index++));
+                return 1;
+            });
+            completed = runTask(task, "Підрахунок");
+        }
+        else {
+            auto it = current->begin();
+            ChunkedTask task(current->size(), [&]() -> size_t {
+                shared_ptr<const TextRope> body = (*it++)->scanBody();
+                account(*body);
+
+                // Довгі тексти діляться пофрагментно; текст вважаємо спільним
+                // стільки разів, скільки власників має його перший фрагмент
+                const auto& chunks = body->getChunks();
+                for (const auto& chunk : chunks) {
+                    double owners = static_cast<double>(chunk.use_count());
+                    logicalBytes += chunk->size();
+                    uniqueBytes += chunk->size() / owners;
+                }
+                if (!chunks.empty()) uniqueTexts += 1 / static_cast<double>(chunks.front().use_count());
+                return 1;
+            });
+            completed = runTask(task, "Підрахунок");
+        }
+
+        if (!completed) {
+            screen.begin();
+            screen.line("|       Підрахунок скасовано!      |");
+            screen.line("+----------------------------------+");
+            screen.present();
+            return;
+        }
+
+        screen.begin();
+        screen.line("|        Статистика чату           |");
+        screen.line("+----------------------------------+");
+        screen.line(Row() << "| Всього повідомлень    " << setw(10) << totalMessages << " |");
+        screen.line(Row() << "| Усього слів           " << setw(10) << totalWords << " |");
+        screen.line(Row() << "| Слів у *жирному*      " << setw(10) << boldWords << " |");
+        screen.line(Row() << "| Слів у _курсиві_      " << setw(10) << italicWords << " |");
+        screen.line(Row() << "| Усього символів       " << setw(10) << totalChars << " |");
+        if (!archive) {
+            int savedPercent = logicalBytes > 0 ? static_cast<int>((logicalBytes - uniqueBytes) * 100 / logicalBytes + 0.5) : 0;
+            screen.line(Row() << "| Унікальних текстів    " << setw(10) << static_cast<long long>(uniqueTexts + 0.5) << " |");
+            screen.line(Row() << "| Дублікатів тексту, %  " << setw(10) << savedPercent << " |");
+        }
+        screen.line("+----------------------------------+");
+
+        if (!archive) {
+            shared_ptr<BodyCache> bodies = currentCache();
+            screen.line("|        Пам'ять переписки         |");
+            screen.line("+----------------------------------+");
+            screen.line(Row() << "| Резидентно, КіБ       " << setw(10) << bodies->residentBytes / 1024 << " |");
+            screen.line(Row() << "| Бюджет, КіБ           " << setw(10) << MEMORY_BUDGET / 1024 << " |");
+            screen.line(Row() << "| Звернень з пам'яті    " << setw(10) << bodies->hits << " |");
+            screen.line(Row() << "| Підвантажено з диска  " << setw(10) << bodies->misses << " |");
+            screen.line("+----------------------------------+");
+        }
+
+        frameTopWords("|     Найчастіші слова (топ-5)     |", topAll);
+        frameTopWords("|      Найчастіші у *жирному*      |", topBold);
+        frameTopWords("|      Найчастіші у _курсиві_      |", topItalic);
+        if (topAll.isApproximate() || topBold.isApproximate() || topItalic.isApproximate()) {
+            screen.line("|  Частоти підраховано наближено   |");
+            screen.line("+----------------------------------+");
+        }
+        screen.present();
+    }
+
+
+
+    void saveToFile() {
+        // Збереження в режимі архіву перезаписало б файл порожньою перепискою
+        if (archive) {
+            screen.begin();
+            screen.line("|  Архів відкрито лише для читання |");
+            screen.line("+----------------------------------+");
+            screen.present();
+            return;
+        }
+
+        HistoryResult result = writeHistory(true);
+
+        screen.begin();
+        if (result == HISTORY_CANCELLED) {
+            screen.line("|      Збереження скасовано!       |");
+        }
+        else if (result != HISTORY_OK) {
+            screen.line("|    Не вдалося зберегти файл!     |");
+        }
+        else {
+            screen.line("|        Переписка збережена!      |");
+        }
+        screen.line("+----------------------------------+");
+        screen.present();
+    }
+
+    // Потоковий експорт повідомлень з ID у межах [fromId, toId]
+    void exportMessages(ExportFormat format, const string& path, int fromId, int toId) const {
+        BufferedWriter out(path);
+        if (!out.isOpen()) {
+            screen.begin();
+            screen.line("|   Не вдалося створити файл!      |");
+            screen.line("+----------------------------------+");
+            screen.present();
+            return;
+        }
+
+        if (format == EXPORT_CSV_UTF8) out.write("\xEF\xBB\xBF");
+        if (format == EXPORT_CSV || format == EXPORT_CSV_UTF8) out.write("id,text\n");
+
+        size_t exported = 0;
+        bool completed;
+        if (archive) {
+            size_t index = 0;
+            ChunkedTask task(archive->count(), [&]() -> size_t {
+                int id = archive->idAt(index);
+                if (id >= fromId && id <= toId) {
+                    writeRecord(out, format, id, archive->textView(index));
+                    exported++;
+                }
+                index++;
+                return 1;
+            });
+            completed = runTask(task, "Експорт");
+        }
+        else {
+            // Діапазон шукаємо в дереві за ID, решту повідомлень не переглядаємо
+            MessageSnapshot current = snapshot();
+            auto it = current->lower_bound(fromId);
+            auto last = current->upper_bound(toId);
+            ChunkedTask task(distance(it, last), [&]() -> size_t {
+                const auto& msg = *it++;
+                writeRecord(out, format, msg->getId(), *msg->scanBody());
+                exported++;
+                return 1;
+            });
+            completed = runTask(task, "Експорт");
+        }
+
+        bool written = out.close();
+
+        screen.begin();
+        if (!completed) {
+            remove(path.c_str());
+            screen.line("|        Експорт скасовано!        |");
+        }
+        else if (!written) {
+            screen.line("|    Помилка запису під час        |");
+            screen.line("|            експорту!             |");
+        }
+        else {
+            screen.line("|       Експорт завершено!         |");
+            screen.line(Row() << "| Експортовано повідомлень " << setw(7) << exported << " |");
+        }
+        screen.line("+----------------------------------+");
+        screen.present();
+    }
+
+    void loadFromFile() {
+        int loadedCount = 0;
+        HistoryResult result = readHistory(true, loadedCount);
+
+        screen.begin();
+        if (result == HISTORY_NOT_FOUND) {
+            screen.line("|         Файл не знайдено!        |");
+        }
+        else if (result == HISTORY_CANCELLED) {
+            screen.line("|     Завантаження скасовано,      |");
+            screen.line("|  переписка залишилась без змін   |");
+        }
+        else if (loadedCount == 0) {
+            screen.line("|     Жодне повідомлення не було   |");
+            screen.line("|           завантажено            |");
+        }
+        else {
+            screen.line("|      Переписка завантажена!      |");
+        }
+        screen.line("+----------------------------------+");
+        screen.present();
+    }
+
+    void mergeFromFiles(const vector<string>& paths, MergePolicy policy) {
+        MergeReport report;
+        HistoryResult result = mergeHistories(paths, policy, true, report);
+
+        screen.begin();
+        if (result == HISTORY_NOT_FOUND) {
+            screen.line("|         Файл не знайдено!        |");
+            screen.line(Row() << "| " << left << setw(32) << report.missingFile.substr(0, 32) << right << " |");
+        }
+        else if (result == HISTORY_CANCELLED) {
+            screen.line("|        Злиття скасовано,         |");
+            screen.line("|  переписка залишилась без змін   |");
+        }
+        else {
+            screen.line("|        Злиття завершено!         |");
+            screen.line("+----------------------------------+");
+            screen.line(Row() << "| Додано або замінено     " << setw(8) << report.imported << " |");
+            screen.line(Row() << "| Однакових дублікатів    " << setw(8) << report.duplicates << " |");
+            screen.line(Row() << "| Конфліктів ID           " << setw(8) << report.conflicts << " |");
+            screen.line(Row() << "| Перенумеровано          " << setw(8) << report.renumbered << " |");
+            if (report.sortedInMemory > 0) {
+                screen.line(Row() << "| Невідсортованих файлів  " << setw(8) << report.sortedInMemory << " |");
+            }
+            if (report.malformed > 0) {
+                screen.line(Row() << "| Некоректних рядків      " << setw(8) << report.malformed << " |");
+            }
         }
+        screen.line("+----------------------------------+");
+        screen.present();
     }
 
-    bool editMessageById(int idToEdit, const string& newText) {
-        for (auto& msg : messages) {
-            if (msg->getId() == idToEdit) {
-                shared_ptr<Message> editedMsg = make_shared<SimpleMessage>(newText, idToEdit);
-                messages.erase(msg);
-                messages.insert(editedMsg);
-
-                if (idToEdit > Message::getGlobalCounter()) {
-                    Message::setGlobalCounter(idToEdit);
-                }
+    // Пошук без урахування регістру по поточній версії переписки або,
+    // в режимі архіву, по відображеному файлу
+    SearchCursor search(const string& keyword, size_t offset = 0) const {
+        if (archive) return SearchCursor(shared_ptr<const MappedHistory>(archive), keyword, offset);
+        return SearchCursor(snapshot(), keyword, offset);
+    }
 
-                return true;
-            }
-        }
-        return false;
+    // Виводить наступні limit збігів курсора одразу, щойно їх знайдено, і
+    // зупиняє перегляд, коли сторінку заповнено. Рядок прогресу runTask
+    // перед кожним результатом стирається. false — пошук скасовано.
+    bool showResults(SearchCursor& cursor, const string& keyword, size_t limit) const {
+        size_t shown = 0;
+        ChunkedTask task(cursor.remaining(), [&]() -> size_t {
+            if (shown == limit) return 0;
+
+            cursor.advance([&](const TextRope& text, int id) {
+                cout << "\r\033[K";
+                highlightMatch(text, keyword, id);
+                shown++;
+            });
+            return 1;
+        });
+
+        bool completed = runTask(task, "Пошук");
+        if (shown > 0) screen.invalidate();
+        enforceBudget();
+        return completed;
     }
 
-    void deleteMessageById(int idToDelete) {
-        bool found = false;
-        for (auto it = messages.begin(); it != messages.end(); ++it) {
-            if ((*it)->getId() == idToDelete) {
-                messages.erase(it);
-                found = true;
-                system("cls");
-                showMenu();
-                cout << "|   Повідомлення видалено успішно  |" << endl;
-                cout << "+----------------------------------+" << endl;
-                return;
-            }
+    // Одна сторінка результатів
+    void searchMessages(const string& keyword, size_t offset = 0, size_t limit = SIZE_MAX) const {
+        screen.begin();
+        screen.line("|        Результати пошуку         |");
+        screen.line("+----------------------------------+");
+        screen.present();
+
+        SearchCursor cursor = search(keyword, offset);
+        if (!showResults(cursor, keyword, limit)) {
+            screen.begin();
+            screen.line("|         Пошук скасовано!         |");
+            screen.line("+----------------------------------+");
+            screen.present();
         }
-        if (!found) {
-            system("cls");
-            showMenu();
-            cout << "|   Повідомлення з таким ID нема   |" << endl;
-            cout << "+----------------------------------+" << endl;
+        else if (cursor.matched() == 0) {
+            screen.begin();
+            screen.line("|     Повідомлення не знайдено     |");
+            screen.line("+----------------------------------+");
+            screen.present();
         }
     }
 
 
-    void showStatistics() const {
-        int totalMessages = messages.size();
-        int totalWords = 0, totalChars = 0;
-        int boldWords = 0, italicWords = 0;
-
-        for (const auto& msg : messages) {
-            string txt = msg->getText();
-            totalChars += txt.length();
-
-            bool inBold = false, inItalic = false;
-            string currentWord;
-            int localBold = 0, localItalic = 0;
-
-            for (size_t i = 0; i <= txt.length(); ++i) {
-                char ch = (i < txt.length()) ? txt[i] : ' '; // щоб обробити останнє слово
-
-                if (ch == '*' && (i == 0 || txt[i - 1] != '\\')) {
-                    if (!currentWord.empty()) {
-                        if (inBold) localBold++;
-                        else if (inItalic) localItalic++;
-                        else totalWords++;
-                        currentWord.clear();
-                    }
-                    inBold = !inBold;
-                    continue;
-                }
 
-                if (ch == '_' && (i == 0 || txt[i - 1] != '\\')) {
-                    if (!currentWord.empty()) {
-                        if (inBold) localBold++;
-                        else if (inItalic) localItalic++;
-                        else totalWords++;
-                        currentWord.clear();
-                    }
-                    inItalic = !inItalic;
-                    continue;
-                }
 
-                if (isspace((unsigned char)ch) || ispunct((unsigned char)ch)) {
-                    if (!currentWord.empty()) {
-                        if (inBold) localBold++;
-                        else if (inItalic) localItalic++;
-                        else totalWords++;
-                        currentWord.clear();
-                    }
-                }
-                else {
-                    currentWord += ch;
-                }
-            }
+    // Очищення без підтвердження (відтворення сесії)
+    void clear() {
+        lock_guard<mutex> guard(writeMutex);
+        resetContents();
+        changes->emit(CHANGE_CLEARED);
+        dirty = true;
+    }
+
+    // Повертає true, якщо користувач підтвердив очищення
+    bool clearMessages() {
+        char confirm;
+        screen.begin();
+        screen.line("|      Ви впевнені, що хочете      |");
+        screen.line("|    видалити всі повідомлення?    |");
+        screen.line("+----------------------------------+");
+        screen.present();
+        cout << "(Y/N): ";
+        cin >> confirm;
+        cin.ignore(); // Очищення буфера
 
-            boldWords += localBold;
-            italicWords += localItalic;
+        if (confirm == 'y' || confirm == 'Y') {
+            clear();
+            screen.begin();
+            screen.line("|         Переписка очищена        |");
+            screen.line("+----------------------------------+");
+            screen.present();
+            return true;
         }
 
-        cout << "|        Статистика чату           |" << endl;
-        cout << "+----------------------------------+" << endl;
-        cout << "| Всього повідомлень          " << setw(4) << totalMessages << " |" << endl;
-        cout << "| Загальна кількість слів     " << setw(4) << totalWords << " |" << endl;
-        cout << "| Слів у *жирному*            " << setw(4) << boldWords << " |" << endl;
-        cout << "| Слів у _курсиві_            " << setw(4) << italicWords << " |" << endl;
-        cout << "| Загальна кількість символів " << setw(4) << totalChars << " |" << endl;
-        cout << "+----------------------------------+" << endl;
+        screen.begin();
+        screen.line("|        Видалення скасовано       |");
+        screen.line("+----------------------------------+");
+        screen.present();
+        return false;
     }
 
+};
 
 
-    void saveToFile() {
-        ofstream file(filename);
-        for (const auto& msg : messages) {
-            string text = msg->getText();
-            size_t pos = 0;
-            while ((pos = text.find('\n', pos)) != string::npos) {
-                text.replace(pos, 1, "\\n");
-                pos += 2;
+// Менеджер чатів: кожен чат — окремий MessageStorage зі своїм файлом.
+// Чат завантажується при першому зверненні й лишається в LRU-кеші, доки
+// сумарний обсяг відкритих чатів не перевищить бюджет пам'яті; тоді
+// найдавніше використані чати зберігаються (якщо є зміни) і закриваються.
+class ChatManager {
+private:
+    struct OpenChat {
+        string name;
+        shared_ptr<MessageStorage> storage;
+    };
+
+    list<OpenChat> recent; // на початку — поточний чат
+    unordered_map<string, list<OpenChat>::iterator> index;
+    size_t memoryBudget;
+
+    // Файли чатів — prefix + назва + ".txt". Для відтворення сесії це
+    // робочі копії: при першому відкритті чату файл заповнюється знімком
+    // seedPrefix + назва + ".txt", тож живі файли лишаються недоторканими
+    string prefix;
+    string seedPrefix;
+    unordered_set<string> seeded;
+
+    // Чати, які при останньому витісненні не вдалося зберегти
+    vector<string> unsaved;
+
+    // Чат, який не вдалося зберегти, лишається в пам'яті разом зі змінами;
+    // замість нього витісняються давніші за ним
+    void evict() {
+        unsaved.clear();
+        size_t used = memoryUsage();
+        auto victim = recent.end();
+        while (used > memoryBudget && --victim != recent.begin()) {
+            if (!victim->storage->flush()) {
+                unsaved.push_back(victim->name);
+                continue;
             }
-            file << "ID: " << msg->getId() << "|" << text << endl;
+            used -= victim->storage->memoryUsage();
+            index.erase(victim->name);
+            victim = recent.erase(victim);
         }
-        system("cls");
-        showMenu();
-        cout << "|        Переписка збережена!      |" << endl;
-        cout << "+----------------------------------+" << endl;
     }
 
-    void loadFromFile() {
-        messages.clear();
-        ifstream file(filename);
+public:
+    static const size_t DEFAULT_BUDGET = 128 * 1024 * 1024;
 
-        if (!file.is_open()) {
-            system("cls");
-            showMenu();
-            cout << "|         Файл не знайдено!        |" << endl;
-            cout << "+----------------------------------+" << endl;
-            return;
-        }
+    explicit ChatManager(size_t budget = DEFAULT_BUDGET, const string& filePrefix = "",
+        const string& seedFilePrefix = "")
+        : memoryBudget(budget), prefix(filePrefix), seedPrefix(seedFilePrefix) {}
 
-        string line;
-        int loadedCount = 0;
+    static bool isValidName(const string& name) {
+        if (name.empty() || name.length() > 64) return false;
+        return name.find_first_of("\\/:*?\"<>|. ") == string::npos;
+    }
 
-        while (getline(file, line)) {
-            size_t delim = line.find('|');
-            if (delim != string::npos) {
-                string idPart = line.substr(0, delim);
-                string text = line.substr(delim + 1);
-                size_t colon = idPart.find(':');
-
-                if (colon != string::npos) {
-                    string idStr = idPart.substr(colon + 1);
-                    try {
-                        int id = stoi(idStr);
-
-                        // Зворотня заміна \\n на реальні переноси
-                        size_t pos = 0;
-                        while ((pos = text.find("\\n", pos)) != string::npos) {
-                            text.replace(pos, 2, "\n");
-                            pos += 1;
-                        }
-
-                        shared_ptr<Message> msg = make_shared<SimpleMessage>(text, id);
-                        messages.insert(msg);
-                        loadedCount++;
-                    }
-                    catch (...) {
-                        cout << "Пропущено некоректний рядок: " << line << endl;
-                    }
-                }
-            }
-        }
+    string fileFor(const string& name) const {
+        return prefix + name + ".txt";
+    }
 
-        if (loadedCount == 0) {
-            system("cls");
-            showMenu();
-            cout << "|     Жодне повідомлення не було   |" << endl;
-            cout << "|           завантажено            |" << endl;
-            cout << "+----------------------------------+" << endl;
+    MessageStorage& open(const string& name) {
+        auto found = index.find(name);
+        if (found != index.end()) {
+            recent.splice(recent.begin(), recent, found->second);
         }
         else {
-            system("cls");
-            showMenu();
-            cout << "|      Переписка завантажена!      |" << endl;
-            cout << "+----------------------------------+" << endl;
+            if (!seedPrefix.empty() && seeded.insert(name).second) {
+                copyHistoryFile(seedPrefix + name + ".txt", fileFor(name));
+            }
+
+            OpenChat chat;
+            chat.name = name;
+            chat.storage = make_shared<MessageStorage>(fileFor(name));
+            chat.storage->open();
+            recent.push_front(chat);
+            index[name] = recent.begin();
+            evict();
         }
+
+        recent.front().storage->activate();
+        return *recent.front().storage;
     }
 
-    void searchMessages(const string& keyword) const {
-        vector<shared_ptr<Message>> results;
+    MessageStorage& current() {
+        return *recent.front().storage;
+    }
 
-        // Зниження регістру ключового слова
-        string loweredKeyword = keyword;
-        transform(loweredKeyword.begin(), loweredKeyword.end(), loweredKeyword.begin(), ::tolower);
+    const string& currentName() const {
+        return recent.front().name;
+    }
 
-        for (const auto& msg : messages) {
-            string originalText = msg->getText();
+    size_t openCount() const {
+        return recent.size();
+    }
 
-            // Зниження регістру тексту повідомлення
-            string loweredText = originalText;
-            transform(loweredText.begin(), loweredText.end(), loweredText.begin(), ::tolower);
+    const vector<string>& unsavedChats() const {
+        return unsaved;
+    }
 
-            size_t pos = loweredText.find(loweredKeyword);
-            if (pos != string::npos) {
-                results.push_back(msg);
-            }
-        }
+    size_t memoryUsage() const {
+        size_t total = 0;
+        for (const auto& chat : recent) total += chat.storage->memoryUsage();
+        return total;
+    }
 
-        if (!results.empty()) {
-            system("cls");
-            showMenu();
-            cout << "|        Результати пошуку         |" << endl;
-            cout << "+----------------------------------+" << endl;
-            for (const auto& msg : results) {
-                highlightMatch(msg->getText(), keyword, msg->getId());
-            }
-        }
-        else {
-            system("cls");
-            showMenu();
-            cout << "|     Повідомлення не знайдено     |" << endl;
-            cout << "+----------------------------------+" << endl;
+    // Зберігає всі відкриті чати з незбереженими змінами
+    bool flushAll() {
+        bool ok = true;
+        for (auto& chat : recent) {
+            if (!chat.storage->flush()) ok = false;
         }
+        return ok;
     }
+};
 
 
+// Запис сесії (--record файл): кожна дія користувача дописується у файл
+// трасування рядком "дія[ аргумент][|текст]"; переноси в тексті
+// записуються як \\n, так само як у messages.txt. Історія кожного чату
+// на момент першого відкриття копіюється поруч: файл.назва.txt
+struct SessionOp {
+    string name;
+    string arg;
+    string text;
+};
 
-    void clearMessages() {
-        char confirm;
-        system("cls");
-        showMenu();
-        cout << "|      Ви впевнені, що хочете      |" << endl;
-        cout << "|    видалити всі повідомлення?    |" << endl;
-        cout << "+----------------------------------+" << endl;
-        cout << "(Y/N): ";
-        cin >> confirm;
-        cin.ignore(); // Очищення буфера
+class SessionRecorder {
+private:
+    ofstream trace;
+    string path;
+    unordered_set<string> captured;
 
-        if (confirm == 'y' || confirm == 'Y') {
-            messages.clear();
-            system("cls");
-            showMenu();
-            cout << "|         Переписка очищена        |" << endl;
-            cout << "+----------------------------------+" << endl;
-        }
-        else {
-            system("cls");
-            showMenu();
-            cout << "|        Видалення скасовано       |" << endl;
-            cout << "+----------------------------------+" << endl;
-        }
+    void writeHead(const string& op, const string& arg) {
+        trace << op;
+        if (!arg.empty()) trace << ' ' << arg;
+    }
+
+public:
+    bool start(const string& tracePath) {
+        path = tracePath;
+        trace.open(path);
+        return trace.is_open();
+    }
+
+    // Префікс знімків історії для ChatManager, що відтворює це трасування
+    static string seedPrefix(const string& tracePath) {
+        return tracePath + ".";
+    }
+
+    // Знімає початковий стан чату, щоб відтворення стартувало з нього ж
+    void capture(const string& name, const string& file) {
+        if (!trace.is_open() || !captured.insert(name).second) return;
+        copyHistoryFile(file, seedPrefix(path) + name + ".txt");
+    }
+
+    void record(const string& op, const string& arg = "") {
+        if (!trace.is_open()) return;
+        writeHead(op, arg);
+        trace << '\n' << flush;
+    }
+
+    template <typename Text>
+    void record(const string& op, const string& arg, const Text& text) {
+        if (!trace.is_open()) return;
+        writeHead(op, arg);
+        trace.put('|');
+        forEachChunk(text, [&](const char* data, size_t size) {
+            for (size_t i = 0; i < size; i++) {
+                if (data[i] == '\n') trace.write("\\n", 2);
+                else trace.put(data[i]);
+            }
+        });
+        trace << '\n' << flush;
     }
 
+    static bool parse(const string& line, SessionOp& op) {
+        size_t bar = line.find('|');
+        string head = line.substr(0, bar);
+        size_t space = head.find(' ');
+
+        op.name = head.substr(0, space);
+        op.arg = space == string::npos ? "" : head.substr(space + 1);
+        op.text = bar == string::npos ? "" : line.substr(bar + 1);
+        unescapeNewlines(op.text);
+        return !op.name.empty();
+    }
 };
 
+SessionRecorder session;
 
 ////////////////////////////////////
 
-bool isCancelled(const string& input) {
-    return input == "/cancel";
-}
-
 void addMessageFlow(MessageStorage& storage) {
-    system("cls");
-    showMenu();
-    cout << "|            Підказка:             |" << endl;
-    cout << "+----------------------------------+" << endl;
-    cout << "|  Щоб зробити жирний або курсив   |" << endl;
-    cout << "|   скористуйтеся форматуванням    |" << endl;
-    cout << "|       *Жирний* _Курсив_          |" << endl;
-    cout << "| Щоб завершити введення, впишіть  |" << endl;
-    cout << "|       /0 на новому рядку         |" << endl;
-    cout << "| АБО /cancel — щоб вийти без змін |" << endl;
-    cout << "+----------------------------------+" << endl;
+    screen.begin();
+    screen.line("|            Підказка:             |");
+    screen.line("+----------------------------------+");
+    screen.line("|  Щоб зробити жирний або курсив   |");
+    screen.line("|   скористуйтеся форматуванням    |");
+    screen.line("|       *Жирний* _Курсив_          |");
+    screen.line("| Щоб завершити введення, впишіть  |");
+    screen.line("|       /0 на новому рядку         |");
+    screen.line("| АБО /cancel — щоб вийти без змін |");
+    screen.line("+----------------------------------+");
+    screen.present();
 
     cout << "Введіть текст повідомлення: ";
 
-    string line, text;
+    // Текст накопичується в rope: довгі повідомлення не перевиділяються
+    string line;
+    TextRope text;
+    bool firstLine = true;
     while (true) {
         getline(cin, line);
 
         if (isCancelled(line)) {
-            system("cls");
-            showMenu();
-            cout << "|          Дію скасовано!          |" << endl;
-            cout << "+----------------------------------+" << endl;
+            screen.begin();
+            screen.line("|          Дію скасовано!          |");
+            screen.line("+----------------------------------+");
+            screen.present();
             return;
         }
 
         if (line == "/0") break;
 
-        if (text.length() + line.length() + 1 > 150) {
-            system("cls");
-            showMenu();
-            cout << "|             Увага!               |" << endl;
-            cout << "|        Перевищено леміт          |" << endl;
-            cout << "|          150 символів!           |" << endl;
-            cout << "|    Повідомлення не збережено     |" << endl;
-            cout << "+----------------------------------+" << endl;
-            return;
-        }
-
-        text += line + "\n";
-    }
-
-    // Видаляємо останній \n, якщо він є
-    if (!text.empty() && text.back() == '\n') {
-        text.pop_back();
+        if (!firstLine) text.append("\n", 1);
+        text.append(line);
+        firstLine = false;
     }
+    // Багаторядкове введення могло прокрутити екран під кадром
+    screen.invalidate();
 
     if (text.empty()) {
-        system("cls");
-        showMenu();
-        cout << "|       Повідомлення не може       |" << endl;
-        cout << "|          бути порожнім!          |" << endl;
-        cout << "+----------------------------------+" << endl;
+        screen.begin();
+        screen.line("|       Повідомлення не може       |");
+        screen.line("|          бути порожнім!          |");
+        screen.line("+----------------------------------+");
+        screen.present();
         return;
     }
 
-    if (text.find('|') != string::npos) {
-        system("cls");
-        showMenu();
-        cout << "|       Символ '|' заборонено!     |" << endl;
-        cout << "|     Повідомлення не збережено    |" << endl;
-        cout << "+----------------------------------+" << endl;
+    if (text.count('|') != 0) {
+        screen.begin();
+        screen.line("|       Символ '|' заборонено!     |");
+        screen.line("|     Повідомлення не збережено    |");
+        screen.line("+----------------------------------+");
+        screen.present();
         return;
     }
 
     // Перевірка парності символів форматування
-    int stars = count(text.begin(), text.end(), '*');
-    int underscores = count(text.begin(), text.end(), '_');
+    size_t stars = text.count('*');
+    size_t underscores = text.count('_');
 
     if (stars % 2 != 0 || underscores % 2 != 0) {
-        system("cls");
-        showMenu();
-        cout << "|             Увага!               |" << endl;
+        screen.begin();
+        screen.line("|             Увага!               |");
         if (stars % 2 != 0)
-            cout << "|       непарна кількість *        |" << endl;
+            screen.line("|       непарна кількість *        |");
         if (underscores % 2 != 0)
-            cout << "|       непарна кількість _        |" << endl;
-        cout << "|      форматування може бути      |" << endl;
-        cout << "|           некоректним!           |" << endl;
-        cout << "+----------------------------------+" << endl;
+            screen.line("|       непарна кількість _        |");
+        screen.line("|      форматування може бути      |");
+        screen.line("|           некоректним!           |");
+        screen.line("+----------------------------------+");
+        screen.present();
     }
 
     shared_ptr<Message> msg = make_shared<SimpleMessage>(text);
     storage.addMessage(msg);
+    session.record("add", "", text);
 
-    system("cls");
-    showMenu();
-    cout << "|       Повідомлення додано!       |" << endl;
-    cout << "+----------------------------------+" << endl;
+    screen.begin();
+    screen.line("|       Повідомлення додано!       |");
+    screen.line("+----------------------------------+");
+    screen.present();
 }
 
 
 
 void editMessageFlow(MessageStorage& storage) {
-    system("cls");
-    showMenu();
+    screen.begin();
 
-    if (storage.getMessages().empty()) {
-        cout << "|         Чат порожній!            |" << endl;
-        cout << "|  Додайте спочатку повідомлення   |" << endl;
-        cout << "+----------------------------------+" << endl;
+    if (storage.snapshot()->empty()) {
+        screen.line("|         Чат порожній!            |");
+        screen.line("|  Додайте спочатку повідомлення   |");
+        screen.line("+----------------------------------+");
+        screen.present();
         return;
     }
 
     // Підказка
-    cout << "|             Підказка:            |" << endl;
-    cout << "+----------------------------------+" << endl;
-    cout << "|  Щоб зробити жирний або курсив   |" << endl;
-    cout << "|   скористуйтеся форматуванням    |" << endl;
-    cout << "|       *Жирний* _Курсив_          |" << endl;
-    cout << "| Щоб завершити введення, впишіть  |" << endl;
-    cout << "|       /0 на новому рядку         |" << endl;
-    cout << "| АБО /cancel — щоб вийти без змін |" << endl;
-    cout << "+----------------------------------+" << endl;
+    screen.line("|             Підказка:            |");
+    screen.line("+----------------------------------+");
+    screen.line("|  Щоб зробити жирний або курсив   |");
+    screen.line("|   скористуйтеся форматуванням    |");
+    screen.line("|       *Жирний* _Курсив_          |");
+    screen.line("| Щоб завершити введення, впишіть  |");
+    screen.line("|       /0 на новому рядку         |");
+    screen.line("| АБО /cancel — щоб вийти без змін |");
+    screen.line("+----------------------------------+");
+    screen.present();
 
     // Введення ID
     string inputId;
     cout << "Введіть ID повідомлення для редагування: ";
     getline(cin, inputId);
     if (inputId == "/cancel") {
-        system("cls");
-        showMenu();
-        cout << "|    Дію скасовано користувачем    |" << endl;
-        cout << "+----------------------------------+" << endl;
+        screen.begin();
+        screen.line("|    Дію скасовано користувачем    |");
+        screen.line("+----------------------------------+");
+        screen.present();
         return;
     }
 
@@ -678,17 +3749,18 @@ void editMessageFlow(MessageStorage& storage) {
         id = stoi(inputId);
     }
     catch (...) {
-        system("cls");
-        showMenu();
-        cout << "|         Некоректний ввід!        |" << endl;
-        cout << "|       Введіть ціле число ID      |" << endl;
-        cout << "+----------------------------------+" << endl;
+        screen.begin();
+        screen.line("|         Некоректний ввід!        |");
+        screen.line("|       Введіть ціле число ID      |");
+        screen.line("+----------------------------------+");
+        screen.present();
         return;
     }
 
     // Пошук повідомлення з таким ID
     shared_ptr<Message> originalMsg = nullptr;
-    for (const auto& msg : storage.getMessages()) {
+    MessageSnapshot current = storage.snapshot();
+    for (const auto& msg : *current) {
         if (msg->getId() == id) {
             originalMsg = msg;
             break;
@@ -696,164 +3768,196 @@ void editMessageFlow(MessageStorage& storage) {
     }
 
     if (!originalMsg) {
-        system("cls");
-        showMenu();
-        cout << "|  Повідомлення з таким ID нема!   |" << endl;
-        cout << "+----------------------------------+" << endl;
+        screen.begin();
+        screen.line("|  Повідомлення з таким ID нема!   |");
+        screen.line("+----------------------------------+");
+        screen.present();
         return;
     }
 
     // Введення нового тексту
-    string line, newText;
+    // Текст накопичується в rope: довгі повідомлення не перевиділяються
+    string line;
+    TextRope newText;
+    bool firstLine = true;
     cout << "Введіть новий текст повідомлення:" << endl;
     while (true) {
         getline(cin, line);
 
         if (line == "/cancel") {
-            system("cls");
-            showMenu();
-            cout << "|       Редагування скасовано!     |" << endl;
-            cout << "+----------------------------------+" << endl;
+            screen.begin();
+            screen.line("|       Редагування скасовано!     |");
+            screen.line("+----------------------------------+");
+            screen.present();
             return;
         }
 
         if (line == "/0") break;
 
-        if (newText.length() + line.length() + 1 > 150) {
-            system("cls");
-            showMenu();
-            cout << "|             Увага!               |" << endl;
-            cout << "|        Перевищено леміт          |" << endl;
-            cout << "|          150 символів!           |" << endl;
-            cout << "|  Редагування повідомлення скас.  |" << endl;
-            cout << "+----------------------------------+" << endl;
-            return;
-        }
-
-        newText += line + "\n";
-    }
-
-    // Видаляємо останній символ \n, якщо він є
-    if (!newText.empty() && newText.back() == '\n') {
-        newText.pop_back();
+        if (!firstLine) newText.append("\n", 1);
+        newText.append(line);
+        firstLine = false;
     }
+    screen.invalidate();
 
     if (newText.empty()) {
-        system("cls");
-        showMenu();
-        cout << "|       Повідомлення не може       |" << endl;
-        cout << "|          бути порожнім!          |" << endl;
-        cout << "+----------------------------------+" << endl;
+        screen.begin();
+        screen.line("|       Повідомлення не може       |");
+        screen.line("|          бути порожнім!          |");
+        screen.line("+----------------------------------+");
+        screen.present();
         return;
     }
 
-    if (newText.find('|') != string::npos) {
-        system("cls");
-        showMenu();
-        cout << "|       Символ '|' заборонено!     |" << endl;
-        cout << "|   Повідомлення не відредаговано  |" << endl;
-        cout << "+----------------------------------+" << endl;
+    if (newText.count('|') != 0) {
+        screen.begin();
+        screen.line("|       Символ '|' заборонено!     |");
+        screen.line("|   Повідомлення не відредаговано  |");
+        screen.line("+----------------------------------+");
+        screen.present();
         return;
     }
 
     // Перевірка парності символів форматування
-    int stars = count(newText.begin(), newText.end(), '*');
-    int underscores = count(newText.begin(), newText.end(), '_');
+    size_t stars = newText.count('*');
+    size_t underscores = newText.count('_');
 
     if (stars % 2 != 0 || underscores % 2 != 0) {
-        system("cls");
-        showMenu();
-        cout << "|             Увага!               |" << endl;
+        screen.begin();
+        screen.line("|             Увага!               |");
         if (stars % 2 != 0)
-            cout << "|       непарна кількість *        |" << endl;
+            screen.line("|       непарна кількість *        |");
         if (underscores % 2 != 0)
-            cout << "|       непарна кількість _        |" << endl;
-        cout << "|      форматування може бути      |" << endl;
-        cout << "|           некоректним!           |" << endl;
-        cout << "+----------------------------------+" << endl;
+            screen.line("|       непарна кількість _        |");
+        screen.line("|      форматування може бути      |");
+        screen.line("|           некоректним!           |");
+        screen.line("+----------------------------------+");
+        screen.present();
     }
 
-    // Заміна повідомлення
-    shared_ptr<Message> editedMsg = make_shared<SimpleMessage>(newText, id);
-    storage.deleteMessageById(id);
-    storage.addMessage(editedMsg);
+    // Заміна повідомлення однією публікацією: читачі бачать або стару,
+    // або нову версію, але ніколи — переписку без цього повідомлення
+    if (!storage.editMessageById(id, newText)) {
+        screen.begin();
+        screen.line("|  Повідомлення з таким ID нема!   |");
+        screen.line("+----------------------------------+");
+        screen.present();
+        return;
+    }
+    session.record("edit", to_string(id), newText);
 
-    system("cls");
-    showMenu();
-    cout << "|    Повідомлення відредаговано!   |" << endl;
-    cout << "+----------------------------------+" << endl;
+    screen.begin();
+    screen.line("|    Повідомлення відредаговано!   |");
+    screen.line("+----------------------------------+");
+    screen.present();
 }
 
 
 
 void searchMessageFlow(MessageStorage& storage) {
-    system("cls");
-    showMenu();
+    screen.begin();
 
     // Підказка
-    cout << "|             Підказка:            |" << endl;
-    cout << "+----------------------------------+" << endl;
-    cout << "|     Введіть слово, для пошуку    |" << endl;
-    cout << "|     /cancel — вихід без змін     |" << endl;
-    cout << "|   Програма чуттєва до регістру!  |" << endl;
-    cout << "+----------------------------------+" << endl;
+    screen.line("|             Підказка:            |");
+    screen.line("+----------------------------------+");
+    screen.line("|     Введіть слово, для пошуку    |");
+    screen.line("|     /cancel — вихід без змін     |");
+    screen.line("|   Програма чуттєва до регістру!  |");
+    screen.line("+----------------------------------+");
+    screen.present();
 
     string keyword;
     cout << "Введіть слово для пошуку: ";
     getline(cin, keyword);
 
     if (keyword == "/cancel") {
-        system("cls");
-        showMenu();
-        cout << "|         Пошук скасовано!         |" << endl;
-        cout << "+----------------------------------+" << endl;
+        screen.begin();
+        screen.line("|         Пошук скасовано!         |");
+        screen.line("+----------------------------------+");
+        screen.present();
         return;
     }
 
     if (keyword.empty()) {
-        system("cls");
-        showMenu();
-        cout << "|  Слово для пошуку не може бути   |" << endl;
-        cout << "|            порожнім!             |" << endl;
-        cout << "+----------------------------------+" << endl;
+        screen.begin();
+        screen.line("|  Слово для пошуку не може бути   |");
+        screen.line("|            порожнім!             |");
+        screen.line("+----------------------------------+");
+        screen.present();
         return;
     }
 
-    system("cls");
-    showMenu();
-    storage.searchMessages(keyword);
+    session.record("search", "", keyword);
+
+    // Результати виводяться сторінками: наступна сторінка продовжує
+    // перегляд з того місця, де зупинилась попередня
+    const size_t PAGE_SIZE = 20;
+    screen.begin();
+    screen.line("|        Результати пошуку         |");
+    screen.line("+----------------------------------+");
+    screen.present();
+
+    SearchCursor cursor = storage.search(keyword);
+    while (true) {
+        size_t before = cursor.matched();
+        if (!storage.showResults(cursor, keyword, PAGE_SIZE)) {
+            screen.begin();
+            screen.line("|         Пошук скасовано!         |");
+            screen.line("+----------------------------------+");
+            screen.present();
+            return;
+        }
+        if (cursor.matched() == before && before > 0) {
+            cout << "Більше збігів немає" << endl;
+            break;
+        }
+        if (cursor.exhausted() || cursor.matched() - before < PAGE_SIZE) break;
+
+        string more;
+        cout << "Enter — ще " << PAGE_SIZE << ", /cancel — завершити: ";
+        getline(cin, more);
+        if (isCancelled(more)) break;
+    }
+
+    if (cursor.matched() == 0) {
+        screen.begin();
+        screen.line("|     Повідомлення не знайдено     |");
+        screen.line("+----------------------------------+");
+        screen.present();
+    }
 }
 
 
 void deleteMessageFlow(MessageStorage& storage) {
-    system("cls");
-    showMenu();
+    screen.begin();
 
     // 🔍 Перевірка: якщо чат порожній
-    if (storage.getMessages().empty()) {
-        cout << "|         Чат порожній!            |" << endl;
-        cout << "|  Додайте повідомлення спочатку!  |" << endl;
-        cout << "+----------------------------------+" << endl;
+    if (storage.snapshot()->empty()) {
+        screen.line("|         Чат порожній!            |");
+        screen.line("|  Додайте повідомлення спочатку!  |");
+        screen.line("+----------------------------------+");
+        screen.present();
         return;
     }
 
     // Підказка
-    cout << "|             Підказка:            |" << endl;
-    cout << "+----------------------------------+" << endl;
-    cout << "|  Введіть ID повідомлення, яке    |" << endl;
-    cout << "|        бажаєте видалити          |" << endl;
-    cout << "| Введіть /cancel — вихід без змін |" << endl;
-    cout << "+----------------------------------+" << endl;
+    screen.line("|             Підказка:            |");
+    screen.line("+----------------------------------+");
+    screen.line("|  Введіть ID повідомлення, яке    |");
+    screen.line("|        бажаєте видалити          |");
+    screen.line("| Введіть /cancel — вихід без змін |");
+    screen.line("+----------------------------------+");
+    screen.present();
 
     string inputId;
     cout << "Введіть ID повідомлення для видалення: ";
     getline(cin, inputId);
 
     if (inputId == "/cancel") {
-        system("cls");
-        showMenu();
-        cout << "|       Видалення скасовано        |" << endl;
-        cout << "+----------------------------------+" << endl;
+        screen.begin();
+        screen.line("|       Видалення скасовано        |");
+        screen.line("+----------------------------------+");
+        screen.present();
         return;
 
     }
@@ -869,18 +3973,18 @@ void deleteMessageFlow(MessageStorage& storage) {
     catch (...) {
         int minId = 1;
         int maxId = Message::getGlobalCounter();
-        system("cls");
-        showMenu();
-        cout << "|          Некоректний ID!         |" << endl;
-        cout << "|      Введіть ID від " << minId << " до " << maxId << "       |" << endl;
-        cout << "+----------------------------------+" << endl;
+        screen.begin();
+        screen.line("|          Некоректний ID!         |");
+        screen.line(Row() << "|      Введіть ID від " << minId << " до " << maxId << "       |");
+        screen.line("+----------------------------------+");
+        screen.present();
         return;
-
     }
 
     // Перевірка: чи існує повідомлення з таким ID
     bool exists = false;
-    for (const auto& msg : storage.getMessages()) {
+    MessageSnapshot current = storage.snapshot();
+    for (const auto& msg : *current) {
         if (msg->getId() == id) {
             exists = true;
             break;
@@ -891,59 +3995,265 @@ void deleteMessageFlow(MessageStorage& storage) {
     if (!exists) {
         int minId = 1;
         int maxId = Message::getGlobalCounter();
-        system("cls");
-        showMenu();
-        cout << "|  Повідомлення з таким ID нема!  |" << endl;
-        cout << "|      Введіть ID від " << minId << " до " << maxId << "       |" << endl;
-        cout << "+----------------------------------+" << endl;
+        screen.begin();
+        screen.line("|  Повідомлення з таким ID нема!  |");
+        screen.line(Row() << "|      Введіть ID від " << minId << " до " << maxId << "       |");
+        screen.line("+----------------------------------+");
+        screen.present();
         return;
     }
 
     // Підтвердження
     string confirm;
-    system("cls");
-    showMenu();
-    cout << "|      Ви впевнені, що хочете      |" << endl;
-    cout << "|  видалити повідомлення з ID: " << id << "?  |" << endl;
-    cout << "|    (Y — так ; N — ні ; /cancel)  |" << endl;
-    cout << "+----------------------------------+" << endl;
+    screen.begin();
+    screen.line("|      Ви впевнені, що хочете      |");
+    screen.line(Row() << "|  видалити повідомлення з ID: " << id << "?  |");
+    screen.line("|    (Y — так ; N — ні ; /cancel)  |");
+    screen.line("+----------------------------------+");
+    screen.present();
     cout << "Ваш вибір: ";
     getline(cin, confirm);
 
     if (confirm == "/cancel" || confirm == "n" || confirm == "N") {
-        system("cls");
-        showMenu();
-        cout << "|       Видалення скасовано        |" << endl;
-        cout << "+----------------------------------+" << endl;
+        screen.begin();
+        screen.line("|       Видалення скасовано        |");
+        screen.line("+----------------------------------+");
+        screen.present();
         return;
 
     }
 
     if (confirm == "y" || confirm == "Y") {
         storage.deleteMessageById(id);
+        session.record("delete", to_string(id));
     }
     else {
-        system("cls");
-        showMenu();
-        cout << "|       Некоректне підтвердження   |" << endl;
-        cout << "+----------------------------------+" << endl;
+        screen.begin();
+        screen.line("|       Некоректне підтвердження   |");
+        screen.line("+----------------------------------+");
+        screen.present();
+    }
+
+}
+
+
+void exportFlow(MessageStorage& storage) {
+    screen.begin();
+
+    screen.line("|             Підказка:            |");
+    screen.line("+----------------------------------+");
+    screen.line("|  Формати: 1 — JSON Lines (UTF-8) |");
+    screen.line("|           2 — CSV                |");
+    screen.line("|           3 — сирий з розміткою  |");
+    screen.line("|           4 — CSV (UTF-8)        |");
+    screen.line("| Діапазон ID: \"від до\" або Enter  |");
+    screen.line("|   для всіх; /cancel — вихід      |");
+    screen.line("+----------------------------------+");
+    screen.present();
+
+    string input;
+    cout << "Формат (1-4): ";
+    getline(cin, input);
+    if (isCancelled(input)) {
+        screen.begin();
+        screen.line("|        Експорт скасовано!        |");
+        screen.line("+----------------------------------+");
+        screen.present();
+        return;
+    }
+
+    ExportFormat format;
+    string defaultName;
+    if (input == "1") {
+        format = EXPORT_JSONL;
+        defaultName = "messages.jsonl";
+    }
+    else if (input == "2") {
+        format = EXPORT_CSV;
+        defaultName = "messages.csv";
+    }
+    else if (input == "3") {
+        format = EXPORT_RAW;
+        defaultName = "messages.raw";
+    }
+    else if (input == "4") {
+        format = EXPORT_CSV_UTF8;
+        defaultName = "messages.csv";
+    }
+    else {
+        screen.begin();
+        screen.line("|       Некоректний формат!        |");
+        screen.line("+----------------------------------+");
+        screen.present();
+        return;
+    }
+
+    string path;
+    cout << "Ім'я файлу (Enter — " << defaultName << "): ";
+    getline(cin, path);
+    if (isCancelled(path)) {
+        screen.begin();
+        screen.line("|        Експорт скасовано!        |");
+        screen.line("+----------------------------------+");
+        screen.present();
+        return;
+    }
+    if (path.empty()) path = defaultName;
+
+    string range;
+    cout << "Діапазон ID (від до): ";
+    getline(cin, range);
+    if (isCancelled(range)) {
+        screen.begin();
+        screen.line("|        Експорт скасовано!        |");
+        screen.line("+----------------------------------+");
+        screen.present();
+        return;
+    }
+
+    int fromId = 0, toId = INT_MAX;
+    if (!range.empty()) {
+        istringstream parser(range);
+        if (!(parser >> fromId >> toId) || fromId > toId) {
+            screen.begin();
+            screen.line("|      Некоректний діапазон!       |");
+            screen.line("+----------------------------------+");
+            screen.present();
+            return;
+        }
+    }
+
+    storage.exportMessages(format, path, fromId, toId);
+}
+
+
+void mergeFlow(MessageStorage& storage) {
+    screen.begin();
+
+    screen.line("|             Підказка:            |");
+    screen.line("+----------------------------------+");
+    screen.line("| Файли історії через пробіл, ID в |");
+    screen.line("| кожному — за зростанням. Поточна |");
+    screen.line("| переписка — перше джерело        |");
+    screen.line("| Однакові ID: 1 — новіша версія,  |");
+    screen.line("|   2 — перша, 3 — перенумерувати  |");
+    screen.line("| Введіть /cancel — вихід без змін |");
+    screen.line("+----------------------------------+");
+    screen.present();
+
+    string input;
+    cout << "Файли: ";
+    getline(cin, input);
+    if (isCancelled(input)) {
+        screen.begin();
+        screen.line("|          Дію скасовано!          |");
+        screen.line("+----------------------------------+");
+        screen.present();
+        return;
+    }
+
+    vector<string> paths;
+    istringstream names(input);
+    string path;
+    while (names >> path) paths.push_back(path);
+    if (paths.empty()) {
+        screen.begin();
+        screen.line("|      Не вказано жодного файлу    |");
+        screen.line("+----------------------------------+");
+        screen.present();
+        return;
+    }
+
+    cout << "Політика (1-3): ";
+    getline(cin, input);
+    MergePolicy policy;
+    if (input == "1") policy = MERGE_KEEP_NEWEST;
+    else if (input == "2") policy = MERGE_KEEP_FIRST;
+    else if (input == "3") policy = MERGE_RENUMBER;
+    else {
+        screen.begin();
+        screen.line("|      Некоректна політика!        |");
+        screen.line("+----------------------------------+");
+        screen.present();
+        return;
+    }
+
+    storage.mergeFromFiles(paths, policy);
+    session.record("merge", input, names.str());
+}
+
+void switchChatFlow(ChatManager& chats) {
+    screen.begin();
+
+    screen.line("|             Підказка:            |");
+    screen.line("+----------------------------------+");
+    screen.line("|  Кожен чат зберігається в файлі  |");
+    screen.line("|  <назва>.txt. Основний чат —     |");
+    screen.line("|  messages                        |");
+    screen.line("| Введіть /cancel — вихід без змін |");
+    screen.line("+----------------------------------+");
+    screen.present();
+    cout << "Поточний чат: " << chats.currentName()
+        << " (відкрито в пам'яті: " << chats.openCount() << ")" << endl;
+
+    string name;
+    cout << "Назва чату: ";
+    getline(cin, name);
+
+    if (isCancelled(name)) {
+        screen.begin();
+        screen.line("|          Дію скасовано!          |");
+        screen.line("+----------------------------------+");
+        screen.present();
+        return;
+    }
+
+    if (!ChatManager::isValidName(name)) {
+        screen.begin();
+        screen.line("|      Некоректна назва чату!      |");
+        screen.line("| Без пробілів і символів \\/:*?<>| |");
+        screen.line("+----------------------------------+");
+        screen.present();
+        return;
     }
 
+    MessageStorage& storage = chats.open(name);
+    session.capture(name, chats.fileFor(name));
+    session.record("chat", name);
+
+    screen.begin();
+    screen.line("|          Чат відкрито!           |");
+    screen.line(Row() << "| Повідомлень у чаті:     " << setw(8) << storage.snapshot()->size() << " |");
+    screen.line("+----------------------------------+");
+    if (!chats.unsavedChats().empty()) {
+        screen.line("|  Не вдалося зберегти чати, вони  |");
+        screen.line("|  лишаються відкритими:           |");
+        for (const auto& unsavedName : chats.unsavedChats()) {
+            screen.line(Row() << "|  " << left << setw(32) << unsavedName.substr(0, 32) << right << "|");
+        }
+        screen.line("+----------------------------------+");
+    }
+    screen.present();
 }
 
 
-bool exitFlow(MessageStorage& storage) {
+bool exitFlow(ChatManager& chats) {
 
     string saveInput;
     cout << "Бажаєте зберегти перед виходом? (Y/N): ";
     getline(cin, saveInput);
-    system("cls");
-    showMenu();
 
     if (saveInput == "Y" || saveInput == "y") {
-        storage.saveToFile();
+        chats.current().saveToFile();
+        chats.flushAll();
+    }
+    else if (saveInput == "N" || saveInput == "n") {
+        screen.begin();
+        screen.present();
     }
-    else if (saveInput != "N" && saveInput != "n") {
+    else {
+        screen.begin();
+        screen.present();
         cout << "Некоректний вибір. Введіть Y або N " << endl;
         return false;
     }
@@ -953,22 +4263,160 @@ bool exitFlow(MessageStorage& storage) {
 }
 
 void refreshMenu() {
-    system("cls");
-    showMenu();
+    screen.begin();
+    screen.present();
+}
+
+// Приймач виводу, що все відкидає: при відтворенні рендеринг виконується,
+// але нічого не друкується
+class NullBuffer : public streambuf {
+protected:
+    int overflow(int ch) override { return ch; }
+    streamsize xsputn(const char*, streamsize count) override { return count; }
+};
+
+bool replayOp(ChatManager& chats, const SessionOp& op) {
+    MessageStorage& storage = chats.current();
+    if (op.name == "add") storage.addMessage(make_shared<SimpleMessage>(op.text));
+    else if (op.name == "edit") storage.editMessageById(stoi(op.arg), op.text);
+    else if (op.name == "delete") storage.deleteMessageById(stoi(op.arg));
+    else if (op.name == "search") storage.searchMessages(op.text);
+    else if (op.name == "show") storage.displayMessages();
+    else if (op.name == "save") storage.saveToFile();
+    else if (op.name == "load") storage.loadFromFile();
+    else if (op.name == "stats") storage.showStatistics();
+    else if (op.name == "clear") storage.clear();
+    else if (op.name == "archive") storage.openArchive();
+    else if (op.name == "chat") chats.open(op.arg);
+    else if (op.name == "merge") {
+        vector<string> paths;
+        istringstream names(op.text);
+        string path;
+        while (names >> path) paths.push_back(path);
+        MergePolicy policy = op.arg == "2" ? MERGE_KEEP_FIRST : (op.arg == "3" ? MERGE_RENUMBER : MERGE_KEEP_NEWEST);
+        storage.mergeFromFiles(paths, policy);
+    }
+    else return false;
+    return true;
+}
+
+// Відтворення сесії (--replay файл): дії виконуються над сховищем підряд,
+// без введення та виводу, а наприкінці друкується час кожного виду дій —
+// таблиці з різних збірок можна порівнювати між собою. Кожен запуск
+// стартує із знятої при записі історії і працює з робочими копіями
+// файл.replay.назва.txt: збереження та завантаження не чіпають живих файлів.
+int replaySession(const string& path) {
+    ifstream trace(path);
+    if (!trace.is_open()) {
+        cout << "Файл трасування не знайдено: " << path << endl;
+        return 1;
+    }
+
+    struct Timing {
+        string name;
+        int count = 0;
+        long long micros = 0;
+        long long slowest = 0;
+    };
+    vector<Timing> timings;
+    int skipped = 0;
+    long long totalMicros = 0;
+
+    ChatManager chats(ChatManager::DEFAULT_BUDGET, path + ".replay.", SessionRecorder::seedPrefix(path));
+    chats.open("messages");
+
+    NullBuffer sink;
+    streambuf* console = cout.rdbuf(&sink);
+    interactiveConsole = false;
+
+    string line;
+    while (getline(trace, line)) {
+        SessionOp op;
+        if (!SessionRecorder::parse(line, op)) continue;
+
+        auto started = chrono::steady_clock::now();
+        bool known;
+        try {
+            known = replayOp(chats, op);
+        }
+        catch (...) {
+            known = false; // некоректний ID у трасуванні
+        }
+        long long micros = chrono::duration_cast<chrono::microseconds>(
+            chrono::steady_clock::now() - started).count();
+
+        if (!known) {
+            skipped++;
+            continue;
+        }
+
+        auto timing = find_if(timings.begin(), timings.end(),
+            [&](const Timing& t) { return t.name == op.name; });
+        if (timing == timings.end()) {
+            timings.push_back(Timing());
+            timing = timings.end() - 1;
+            timing->name = op.name;
+        }
+        timing->count++;
+        timing->micros += micros;
+        timing->slowest = max(timing->slowest, micros);
+        totalMicros += micros;
+    }
+
+    cout.rdbuf(console);
+    interactiveConsole = true;
+
+    cout << "+----------------------------------+" << endl;
+    cout << "|       Відтворення сесії          |" << endl;
+    cout << "+----------------------------------+" << endl;
+    cout << "| Дія     К-сть всього мс   мкс/оп |" << endl;
+    cout << "+----------------------------------+" << endl;
+    for (const auto& timing : timings) {
+        cout << "| " << left << setw(7) << timing.name << right << setw(6) << timing.count
+            << fixed << setprecision(1) << setw(10) << timing.micros / 1000.0
+            << setw(9) << timing.micros / timing.count << " |" << endl;
+    }
+    cout << "+----------------------------------+" << endl;
+    cout << "| Разом, мс              " << setw(9) << totalMicros / 1000.0 << " |" << endl;
+    if (skipped > 0) {
+        cout << "| Пропущено рядків       " << setw(9) << skipped << " |" << endl;
+    }
+    cout << "+----------------------------------+" << endl;
+    return 0;
 }
 
 
 
 
-int main() {
+int main(int argc, char* argv[]) {
     SetConsoleOutputCP(1251);
     SetConsoleCP(1251);
     setConsoleColor(8);
 
-    MessageStorage storage;
+    // --record файл — записати сесію; --replay файл — відтворити її
+    for (int i = 1; i + 1 < argc; i++) {
+        string option = argv[i];
+        if (option == "--replay") return replaySession(argv[i + 1]);
+        if (option == "--record" && !session.start(argv[i + 1])) {
+            cout << "Не вдалося створити файл трасування: " << argv[i + 1] << endl;
+            return 1;
+        }
+    }
+
+    ChatManager chats;
+    chats.open("messages");
+    session.capture("messages", chats.fileFor("messages"));
+
+    // Кадри виводяться ESC-послідовностями — вмикаємо їх обробку консоллю
+    HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+    DWORD consoleMode = 0;
+    if (GetConsoleMode(console, &consoleMode)) {
+        SetConsoleMode(console, consoleMode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+    }
 
-    showMenu();
+    refreshMenu();
     while (true) {
+        MessageStorage& storage = chats.current();
         string input;
         int choice = -1; 
 
@@ -979,19 +4427,30 @@ int main() {
             choice = stoi(input);
         }
         catch (...) {
-            system("cls");
-            showMenu();
-            cout << "|         Некоректний вибір        |" << endl;
-            cout << "|     Введіть число від 0 до 9     |" << endl;
-            cout << "+----------------------------------+" << endl;
+            screen.begin();
+            screen.line("|         Некоректний вибір        |");
+            screen.line("|     Введіть число від 0 до 13    |");
+            screen.line("+----------------------------------+");
+            screen.present();
             continue;
         }
 
-        if (choice < 0 || choice > 9) {
-            system("cls");
-            showMenu();
-            cout << "| Введіть число в межах від 0 до 9 |" << endl;
-            cout << "+----------------------------------+" << endl;
+        if (choice < 0 || choice > 13) {
+            screen.begin();
+            screen.line("|Введіть число в межах від 0 до 13 |");
+            screen.line("+----------------------------------+");
+            screen.present();
+            continue;
+        }
+
+        // Архів відкрито лише для читання: зміни заборонені до завантаження
+        bool modifies = choice == 1 || choice == 3 || choice == 5 || choice == 6 || choice == 8 || choice == 13;
+        if (storage.isArchiveMode() && modifies) {
+            screen.begin();
+            screen.line("|  Архів відкрито лише для читання |");
+            screen.line("|  Завантажте переписку (пункт 4)  |");
+            screen.line("+----------------------------------+");
+            screen.present();
             continue;
         }
 
@@ -1000,29 +4459,38 @@ int main() {
             addMessageFlow(storage);
             break;
         case 2:
-            refreshMenu();
             storage.displayMessages();
+            session.record("show");
             break;
         case 3:
             refreshMenu();
             storage.saveToFile();
+            session.record("save");
             break;
         case 4:
             refreshMenu();
             storage.loadFromFile();
+            session.record("load");
             break;
         case 5: {editMessageFlow(storage); break;}
         case 6:
             refreshMenu();
-            storage.clearMessages();
+            if (storage.clearMessages()) session.record("clear");
             break;
         case 7: {searchMessageFlow(storage); break;}
         case 8: {deleteMessageFlow(storage); break;}
         case 9:
             refreshMenu();
             storage.showStatistics();
+            session.record("stats");
+            break;
+        case 10:
+            if (storage.openArchive()) session.record("archive");
             break;
-        case 0: {if (exitFlow(storage)) return 0; break;}
+        case 11: {exportFlow(storage); break;}
+        case 12: {switchChatFlow(chats); break;}
+        case 13: {mergeFlow(storage); break;}
+        case 0: {if (exitFlow(chats)) return 0; break;}
         default:
             cout << "Некоректний вибір, спробуйте знову!" << endl;
         }
@@ -0,0 +1,6 @@
+// Заглушка <conio.h> для збирання стрес-тестів поза Windows:
+// клавіатура в тестах не опитується
+#pragma once
+
+inline int _kbhit() { return 0; }
+inline int _getch() { return 0; }
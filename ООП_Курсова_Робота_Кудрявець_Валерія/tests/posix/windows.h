@@ -0,0 +1,132 @@
+// Мінімальна заміна <windows.h> для збирання стрес-тестів на Linux/macOS
+// (ThreadSanitizer у MSVC відсутній). Консольні виклики нічого не роблять,
+// файлові — відображаються на POSIX.
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+typedef unsigned short WORD;
+typedef unsigned long DWORD;
+typedef void* HANDLE;
+typedef int BOOL;
+typedef const char* LPCSTR;
+
+#define STD_OUTPUT_HANDLE ((DWORD)-11)
+#define STD_INPUT_HANDLE ((DWORD)-10)
+#define INVALID_HANDLE_VALUE ((HANDLE)(intptr_t)-1)
+
+#define FOREGROUND_BLUE 0x1
+#define FOREGROUND_GREEN 0x2
+#define FOREGROUND_RED 0x4
+#define FOREGROUND_INTENSITY 0x8
+#define BACKGROUND_GREEN 0x20
+#define BACKGROUND_RED 0x40
+#define BACKGROUND_INTENSITY 0x80
+#define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
+
+#define GENERIC_READ 0x80000000
+#define FILE_SHARE_READ 1
+#define OPEN_EXISTING 3
+#define FILE_ATTRIBUTE_NORMAL 0x80
+#define PAGE_READONLY 2
+#define FILE_MAP_READ 4
+#define MOVEFILE_REPLACE_EXISTING 1
+
+#define _fseeki64 fseeko
+
+struct COORD { short X, Y; };
+struct SMALL_RECT { short Left, Top, Right, Bottom; };
+struct CONSOLE_SCREEN_BUFFER_INFO {
+    COORD dwSize;
+    COORD dwCursorPosition;
+    WORD wAttributes;
+    SMALL_RECT srWindow;
+    COORD dwMaximumWindowSize;
+};
+union LARGE_INTEGER { long long QuadPart; };
+
+inline HANDLE GetStdHandle(DWORD) { return 0; }
+inline BOOL SetConsoleTextAttribute(HANDLE, WORD) { return 1; }
+inline BOOL GetConsoleScreenBufferInfo(HANDLE, CONSOLE_SCREEN_BUFFER_INFO* info) {
+    std::memset(info, 0, sizeof(*info));
+    info->wAttributes = 0xF0;
+    info->srWindow.Bottom = 49;
+    return 1;
+}
+inline BOOL GetConsoleMode(HANDLE, DWORD* mode) { *mode = 0; return 1; }
+inline BOOL SetConsoleMode(HANDLE, DWORD) { return 1; }
+inline BOOL SetConsoleOutputCP(unsigned) { return 1; }
+inline BOOL SetConsoleCP(unsigned) { return 1; }
+
+inline HANDLE CreateFileA(LPCSTR path, DWORD, DWORD, void*, DWORD, DWORD, HANDLE) {
+    int fd = open(path, O_RDONLY);
+    return fd < 0 ? INVALID_HANDLE_VALUE : (HANDLE)(intptr_t)(fd + 1);
+}
+inline BOOL GetFileSizeEx(HANDLE file, LARGE_INTEGER* size) {
+    struct stat st;
+    if (fstat((int)(intptr_t)file - 1, &st) != 0) return 0;
+    size->QuadPart = st.st_size;
+    return 1;
+}
+inline HANDLE CreateFileMappingA(HANDLE file, void*, DWORD, DWORD, DWORD, LPCSTR) { return file; }
+inline void* MapViewOfFile(HANDLE file, DWORD, DWORD, DWORD, size_t) {
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) return 0;
+    void* view = mmap(0, (size_t)size.QuadPart, PROT_READ, MAP_PRIVATE, (int)(intptr_t)file - 1, 0);
+    return view == MAP_FAILED ? 0 : view;
+}
+inline BOOL UnmapViewOfFile(const void*) { return 1; }
+inline BOOL CloseHandle(HANDLE) { return 1; }
+inline BOOL MoveFileExA(LPCSTR from, LPCSTR to, DWORD) { return std::rename(from, to) == 0; }
+
+// Перекодування: з кодових сторінок підтримано лише cp1251 (латиниця,
+// кирилиця, українські літери), з Unicode — лише UTF-8
+#define CP_UTF8 65001
+
+inline int MultiByteToWideChar(unsigned codePage, DWORD, const char* source, int length,
+    wchar_t* target, int capacity) {
+    static const struct { unsigned char byte; wchar_t code; } extra[] = {
+        { 0xA5, 0x0490 }, { 0xA8, 0x0401 }, { 0xAA, 0x0404 }, { 0xAF, 0x0407 }, { 0xB2, 0x0406 },
+        { 0xB3, 0x0456 }, { 0xB4, 0x0491 }, { 0xB8, 0x0451 }, { 0xBA, 0x0454 }, { 0xBF, 0x0457 }
+    };
+    if (codePage != 1251 || length > capacity) return 0;
+    for (int i = 0; i < length; i++) {
+        unsigned char byte = (unsigned char)source[i];
+        wchar_t code = byte < 0x80 ? byte : (byte >= 0xC0 ? 0x0410 + (byte - 0xC0) : L'?');
+        for (const auto& entry : extra) {
+            if (entry.byte == byte) code = entry.code;
+        }
+        target[i] = code;
+    }
+    return length;
+}
+
+inline int WideCharToMultiByte(unsigned codePage, DWORD, const wchar_t* source, int length,
+    char* target, int capacity, const char*, BOOL*) {
+    if (codePage != CP_UTF8) return 0;
+    int used = 0;
+    for (int i = 0; i < length; i++) {
+        unsigned code = (unsigned)source[i];
+        int bytes = code < 0x80 ? 1 : (code < 0x800 ? 2 : 3);
+        if (used + bytes > capacity) return 0;
+        if (bytes == 1) {
+            target[used++] = (char)code;
+        }
+        else if (bytes == 2) {
+            target[used++] = (char)(0xC0 | (code >> 6));
+            target[used++] = (char)(0x80 | (code & 0x3F));
+        }
+        else {
+            target[used++] = (char)(0xE0 | (code >> 12));
+            target[used++] = (char)(0x80 | ((code >> 6) & 0x3F));
+            target[used++] = (char)(0x80 | (code & 0x3F));
+        }
+    }
+    return used;
+}
@@ -0,0 +1,359 @@
+// Стрес-тести конкурентного доступу до MessageStorage. Збираються з
+// -fsanitize=thread (див. Makefile) і разом із власними перевірками
+// покладаються на звіти ThreadSanitizer про гонки даних.
+//
+//   make -C tests tsan
+// Тест може втрутитися в Message::spill() між підміною тіла і зняттям
+// його з обліку (див. refaultDuringSpillIsCounted)
+class Message;
+static void (*onSpillSwap)(Message&) = nullptr;
+#define SPILL_SWAP_HOOK(message) if (onSpillSwap) onSpillSwap(message)
+
+#define main app_main
+#include "../MessageApp.cpp"
+#undef main
+
+#include <map>
+#include <random>
+
+static int failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            cerr << __FILE__ << ":" << __LINE__ << ": перевірка не пройшла: " #condition << endl; \
+            failures++; \
+        } \
+    } while (0)
+
+// Запускає тест і повідомляє, скільки перевірок у ньому не пройшло
+static void run(const char* name, void (*test)()) {
+    int before = failures;
+    test();
+    cerr << (failures == before ? "[ OK ] " : "[FAIL] ") << name << endl;
+}
+
+// Знімок впорядкований, його розмір збігається з кількістю елементів
+static bool consistent(const MessageSet& set) {
+    size_t seen = 0;
+    int previous = INT_MIN;
+    for (const auto& msg : set) {
+        if (msg->getId() <= previous) return false;
+        previous = msg->getId();
+        seen++;
+    }
+    return seen == set.size();
+}
+
+// Незмінна множина проти std::map: вставки, заміни, видалення, межі
+static void persistentSetMatchesMap() {
+    mt19937 random(35);
+    map<int, shared_ptr<Message>> reference;
+    MessageSet set;
+    vector<MessageSet> versions;
+
+    for (int step = 0; step < 20000; step++) {
+        int id = static_cast<int>(random() % 5000) + 1;
+        if (random() % 3 == 0) {
+            set = set.without(id);
+            reference.erase(id);
+        }
+        else {
+            shared_ptr<Message> msg = make_shared<SimpleMessage>(string("m"), id);
+            set = set.with(msg);
+            reference[id] = msg;
+        }
+        if (step % 1000 == 0) versions.push_back(set);
+    }
+
+    CHECK(set.size() == reference.size());
+    CHECK(consistent(set));
+    auto expected = reference.begin();
+    for (const auto& msg : set) {
+        CHECK(expected != reference.end() && msg == expected->second);
+        ++expected;
+    }
+
+    for (int id = 0; id <= 5001; id += 7) {
+        auto found = set.find(id);
+        CHECK((found != set.end()) == (reference.count(id) != 0));
+
+        auto lower = set.lower_bound(id);
+        auto lowerExpected = reference.lower_bound(id);
+        CHECK((lower == set.end()) == (lowerExpected == reference.end()));
+        if (lower != set.end() && lowerExpected != reference.end()) {
+            CHECK((*lower)->getId() == lowerExpected->first);
+        }
+
+        auto upper = set.upper_bound(id);
+        auto upperExpected = reference.upper_bound(id);
+        CHECK((upper == set.end()) == (upperExpected == reference.end()));
+        if (upper != set.end() && upperExpected != reference.end()) {
+            CHECK((*upper)->getId() == upperExpected->first);
+        }
+    }
+
+    // Старі версії не змінились від подальших записів
+    for (const auto& version : versions) CHECK(consistent(version));
+
+    vector<shared_ptr<Message>> sorted;
+    for (const auto& entry : reference) sorted.push_back(entry.second);
+    MessageSet built(sorted.begin(), sorted.end());
+    CHECK(built.size() == sorted.size());
+    CHECK(consistent(built));
+    CHECK(built.back() == sorted.back());
+}
+
+// Читачі беруть знімки, поки писач додає, редагує й видаляє: кожен знімок
+// узгоджений і не змінюється, доки його тримають
+static void snapshotsStayConsistentUnderWrites() {
+    MessageStorage storage("stress_rcu.txt");
+    atomic<bool> done{ false };
+    atomic<long> snapshots{ 0 };
+    atomic<int> broken{ 0 };
+
+    auto reader = [&]() {
+        while (!done.load()) {
+            MessageSnapshot current = storage.snapshot();
+            size_t first = 0, second = 0;
+            for (const auto& msg : *current) {
+                first++;
+                if (msg->scanBody()->empty()) broken++;
+            }
+            for (auto it = current->begin(); it != current->end(); ++it) second++;
+            if (first != second || first != current->size() || !consistent(*current)) broken++;
+            snapshots++;
+        }
+    };
+
+    vector<thread> readers;
+    for (int i = 0; i < 3; i++) readers.push_back(thread(reader));
+
+    NullBuffer sink;
+    streambuf* console = cout.rdbuf(&sink);
+    for (int round = 1; round <= 3000; round++) {
+        storage.addMessage(make_shared<SimpleMessage>(string("повідомлення ") + to_string(round)));
+        if (round % 3 == 0) storage.editMessageById(round - 1, string("редаговане"));
+        if (round % 5 == 0) storage.deleteMessageById(round - 2);
+        if (round % 500 == 0) {
+            vector<shared_ptr<Message>> batch;
+            for (int k = 0; k < 200; k++) batch.push_back(make_shared<SimpleMessage>(string("пакет")));
+            storage.addMessages(batch);
+        }
+    }
+    cout.rdbuf(console);
+
+    done = true;
+    for (auto& t : readers) t.join();
+
+    CHECK(broken.load() == 0);
+    CHECK(snapshots.load() > 0);
+    CHECK(consistent(*storage.snapshot()));
+}
+
+// Очікуваний облік кешу: унікальні фрагменти резидентних тіл
+static size_t residentChunkBytes(const vector<shared_ptr<Message>>& owners) {
+    unordered_set<const string*> seen;
+    size_t total = 0;
+    for (const auto& msg : owners) {
+        if (msg->residentBodyBytes() == 0) continue;
+        shared_ptr<const TextRope> body = msg->getBody();
+        total += body->ownBytes();
+        for (const auto& chunk : body->getChunks()) {
+            if (seen.insert(chunk.get()).second) total += chunk->capacity();
+        }
+    }
+    return total;
+}
+
+// Однакові тіла спільні через TextPool: рахуються один раз, а витіснення
+// не пише дублікатів у файл кешу і не «звільняє» те, що тримають інші
+static void sharedChunksCountOnce() {
+    shared_ptr<BodyCache> cache = make_shared<BodyCache>("stress_shared.spill");
+    string text(3 * TextRope::CHUNK_SIZE, 'x');
+    vector<shared_ptr<Message>> owners;
+    for (int i = 0; i < 100; i++) {
+        owners.push_back(make_shared<SimpleMessage>(text));
+        owners.back()->attach(cache);
+    }
+
+    CHECK(cache->residentBytes == residentChunkBytes(owners));
+    CHECK(cache->spillableBytes == 0);
+    for (const auto& msg : owners) CHECK(msg->spill() == 0);
+    CHECK(cache->residentBytes == residentChunkBytes(owners));
+
+    // Унікальне тіло витісняється, а після видалення останнього власника
+    // спільні фрагменти зникають з обліку
+    owners.push_back(make_shared<SimpleMessage>(string(TextRope::CHUNK_SIZE, 'y')));
+    owners.back()->attach(cache);
+    CHECK(cache->spillableBytes == TextRope::CHUNK_SIZE);
+    CHECK(owners.back()->spill() > 0);
+    CHECK(cache->spillableBytes == 0);
+    CHECK(owners.back()->getBody()->size() == TextRope::CHUNK_SIZE);
+
+    for (const auto& msg : owners) msg->detach();
+    CHECK(cache->residentBytes == 0);
+    CHECK(cache->spillableBytes == 0);
+}
+
+// Читач підвантажує тіло рівно між підміною тіла у spill() і зняттям
+// старого з обліку: нове тіло все одно враховане і може бути витіснене знову
+static thread faultIn;
+
+static void faultInDuringSwap(Message& message) {
+    onSpillSwap = nullptr;
+    const Message* target = &message;
+    faultIn = thread([target]() { target->getBody(); });
+    // Читач уже підставив підвантажене тіло і чекає на облік у track()
+    while (target->residentBodyBytes() == 0) this_thread::yield();
+}
+
+static void refaultDuringSpillIsCounted() {
+    shared_ptr<BodyCache> cache = make_shared<BodyCache>("stress_refault.spill");
+    vector<shared_ptr<Message>> owners;
+    owners.push_back(make_shared<SimpleMessage>("унікальне тіло " + string(2 * TextRope::CHUNK_SIZE, 'r')));
+    owners.back()->attach(cache);
+
+    onSpillSwap = faultInDuringSwap;
+    CHECK(owners.back()->spill() > 0);
+    faultIn.join();
+
+    CHECK(owners.back()->residentBodyBytes() != 0);
+    CHECK(cache->residentBytes == residentChunkBytes(owners));
+    CHECK(cache->spillableBytes != 0);
+    CHECK(owners.back()->spill() > 0);
+    CHECK(cache->residentBytes == 0);
+}
+
+// Читачі підвантажують тіла, поки інший потік їх витісняє, а писач
+// вилучає повідомлення: облік сходиться з фактичним станом
+static void spillAccountingUnderReaders() {
+    shared_ptr<BodyCache> cache = make_shared<BodyCache>("stress_spill.spill");
+    vector<shared_ptr<Message>> owners;
+    for (int i = 0; i < 300; i++) {
+        string text = i % 3 == 0 ? string("спільний шаблон") : "тіло " + to_string(i) + string(i * 40, 'z');
+        owners.push_back(make_shared<SimpleMessage>(text));
+        owners.back()->attach(cache);
+    }
+
+    atomic<bool> done{ false };
+    atomic<int> broken{ 0 };
+    auto reader = [&](int seed) {
+        mt19937 random(seed);
+        while (!done.load()) {
+            const auto& msg = owners[random() % owners.size()];
+            if (msg->getBody()->empty()) broken++;
+        }
+    };
+
+    vector<thread> readers;
+    for (int i = 0; i < 2; i++) readers.push_back(thread(reader, i));
+    thread spiller([&]() {
+        for (int round = 0; round < 200; round++) {
+            for (const auto& msg : owners) msg->spill();
+        }
+    });
+    spiller.join();
+    done = true;
+    for (auto& t : readers) t.join();
+
+    CHECK(broken.load() == 0);
+    CHECK(!cache->failed);
+    CHECK(cache->residentBytes == residentChunkBytes(owners));
+
+    vector<shared_ptr<Message>> kept;
+    for (size_t i = 0; i < owners.size(); i++) {
+        if (i % 2 == 0) owners[i]->detach();
+        else kept.push_back(owners[i]);
+    }
+    CHECK(cache->residentBytes == residentChunkBytes(kept));
+}
+
+// Дзеркало переписки за стрічкою змін у окремому потоці: після всіх
+// змін воно збігається зі сховищем. Пакет, більший за ємність стрічки,
+// приходить однією подією CHANGE_RELOADED.
+static void mirrorFollowsChangeFeed() {
+    MessageStorage storage("stress_feed.txt");
+    ChangeSubscription bulk = storage.subscribe();
+    vector<shared_ptr<Message>> large;
+    for (unsigned long long k = 0; k < ChangeFeed::CAPACITY * 2; k++) {
+        large.push_back(make_shared<SimpleMessage>(string("великий пакет")));
+    }
+    storage.addMessages(large);
+    vector<ChangeEvent> events;
+    CHECK(bulk.poll(events) == 1);
+    CHECK(!events.empty() && events[0].type == CHANGE_RELOADED);
+
+    ChangeSubscription subscription = storage.subscribe();
+    map<int, unsigned long long> mirror;
+    atomic<bool> done{ false };
+    int gaps = 0;
+
+    thread follower([&]() {
+        vector<ChangeEvent> batch;
+        unsigned long long lastSequence = subscription.position();
+        auto resync = [&]() {
+            mirror.clear();
+            MessageSnapshot current = storage.snapshot();
+            for (const auto& msg : *current) mirror[msg->getId()] = msg->getVersion();
+        };
+        resync();
+
+        while (true) {
+            bool finished = done.load();
+            while (subscription.poll(batch) > 0) {
+                for (const auto& event : batch) {
+                    // Відставання допустиме: дзеркало перечитує знімок
+                    if (event.type == CHANGE_OVERRUN) {
+                        resync();
+                        lastSequence = event.sequence;
+                        continue;
+                    }
+                    if (event.sequence != lastSequence + 1) gaps++;
+                    lastSequence = event.sequence;
+
+                    if (event.type == CHANGE_ADDED || event.type == CHANGE_EDITED) mirror[event.id] = event.version;
+                    else if (event.type == CHANGE_DELETED) mirror.erase(event.id);
+                    else if (event.type == CHANGE_CLEARED) mirror.clear();
+                    else if (event.type == CHANGE_RELOADED) resync();
+                }
+            }
+            if (finished) break;
+        }
+    });
+
+    NullBuffer sink;
+    streambuf* console = cout.rdbuf(&sink);
+    for (int round = 1; round <= 3000; round++) {
+        storage.addMessage(make_shared<SimpleMessage>(string("m") + to_string(round)));
+        if (round % 3 == 0) storage.editMessageById(Message::getGlobalCounter(), string("e"));
+        if (round % 7 == 0) storage.deleteMessageById(Message::getGlobalCounter() - 1);
+        if (round == 1500) storage.clear();
+        if (round % 700 == 1) {
+            vector<shared_ptr<Message>> batch;
+            for (int k = 0; k < 50; k++) batch.push_back(make_shared<SimpleMessage>(string("b")));
+            storage.addMessages(batch);
+        }
+    }
+    cout.rdbuf(console);
+
+    done = true;
+    follower.join();
+
+    map<int, unsigned long long> truth;
+    MessageSnapshot current = storage.snapshot();
+    for (const auto& msg : *current) truth[msg->getId()] = msg->getVersion();
+    CHECK(mirror == truth);
+    CHECK(gaps == 0);
+    CHECK(storage.subscribe().position() == subscription.position());
+}
+
+int main() {
+    run("persistentSetMatchesMap", persistentSetMatchesMap);
+    run("snapshotsStayConsistentUnderWrites", snapshotsStayConsistentUnderWrites);
+    run("sharedChunksCountOnce", sharedChunksCountOnce);
+    run("refaultDuringSpillIsCounted", refaultDuringSpillIsCounted);
+    run("spillAccountingUnderReaders", spillAccountingUnderReaders);
+    run("mirrorFollowsChangeFeed", mirrorFollowsChangeFeed);
+    return failures == 0 ? 0 : 1;
+}